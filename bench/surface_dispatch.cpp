@@ -0,0 +1,227 @@
+/*
+ * Per buffer cost of resolving what a draw list item needs from the surface
+ * it belongs to: the is_popup()/is_view() virtual calls and dynamic_casts the
+ * renderer used to go through, against the switch on Surface::type and the
+ * fill_surface_item specializations it uses now.
+ *
+ * The surface classes are cut down to what the renderer touches, with the
+ * same shape as the real ones (virtual predicates, a View base with xdg and
+ * X11 implementations), so this builds without wlroots.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+struct Box {
+    int x, y, width, height;
+};
+
+enum SurfaceType {
+    NAOLAND_SURFACE_TYPE_VIEW,
+    NAOLAND_SURFACE_TYPE_LAYER,
+    NAOLAND_SURFACE_TYPE_POPUP,
+};
+
+struct Animation {
+    int step = 0;
+};
+
+struct Surface {
+    SurfaceType const type;
+
+    explicit Surface(SurfaceType type)
+        : type(type)
+    {
+    }
+    virtual ~Surface() = default;
+
+    [[nodiscard]] virtual bool is_view() const = 0;
+    [[nodiscard]] virtual bool is_popup() const = 0;
+};
+
+struct View : Surface {
+    Animation animation;
+    Box geometry = { 4, 4, 640, 480 };
+
+    View()
+        : Surface(NAOLAND_SURFACE_TYPE_VIEW)
+    {
+    }
+
+    [[nodiscard]] bool is_view() const override { return true; }
+    [[nodiscard]] bool is_popup() const override { return false; }
+    [[nodiscard]] virtual bool is_x11() const = 0;
+    [[nodiscard]] virtual Box get_geometry() const = 0;
+};
+
+struct XdgView final : View {
+    [[nodiscard]] bool is_x11() const override { return false; }
+    [[nodiscard]] Box get_geometry() const override { return geometry; }
+};
+
+struct XWaylandView final : View {
+    [[nodiscard]] bool is_x11() const override { return true; }
+    [[nodiscard]] Box get_geometry() const override { return geometry; }
+};
+
+struct Popup final : Surface {
+    Animation animation;
+
+    Popup()
+        : Surface(NAOLAND_SURFACE_TYPE_POPUP)
+    {
+    }
+
+    [[nodiscard]] bool is_view() const override { return false; }
+    [[nodiscard]] bool is_popup() const override { return true; }
+};
+
+struct Layer final : Surface {
+    Layer()
+        : Surface(NAOLAND_SURFACE_TYPE_LAYER)
+    {
+    }
+
+    [[nodiscard]] bool is_view() const override { return false; }
+    [[nodiscard]] bool is_popup() const override { return false; }
+};
+
+struct DrawItem {
+    Surface* surface;
+    View* view;
+    Animation* animation;
+    Box box;
+    Box border_box;
+};
+
+/* What build_buffer_item() did before surfaces were tagged */
+__attribute__((noinline)) static void fill_item_rtti(DrawItem& item)
+{
+    item.view = nullptr;
+    item.animation = nullptr;
+    if (item.surface->is_popup()) {
+        item.animation = &dynamic_cast<Popup*>(item.surface)->animation;
+    } else if (item.surface->is_view()) {
+        item.view = dynamic_cast<View*>(item.surface);
+        item.animation = &item.view->animation;
+    }
+
+    item.border_box = item.box;
+    if (item.view && !item.view->is_x11()) {
+        Box const geom = item.view->get_geometry();
+        item.border_box = { item.box.x + geom.x, item.box.y + geom.y,
+                            geom.width, geom.height };
+    }
+}
+
+template <SurfaceType Type> static void fill_surface_item(DrawItem&);
+
+template <> void fill_surface_item<NAOLAND_SURFACE_TYPE_VIEW>(DrawItem& item)
+{
+    auto* view = static_cast<View*>(item.surface);
+    item.view = view;
+    item.animation = &view->animation;
+
+    if (!view->is_x11()) {
+        Box const geom = view->get_geometry();
+        item.border_box = { item.box.x + geom.x, item.box.y + geom.y,
+                            geom.width, geom.height };
+    }
+}
+
+template <> void fill_surface_item<NAOLAND_SURFACE_TYPE_POPUP>(DrawItem& item)
+{
+    item.animation = &static_cast<Popup*>(item.surface)->animation;
+}
+
+template <> void fill_surface_item<NAOLAND_SURFACE_TYPE_LAYER>(DrawItem&) { }
+
+/* What build_buffer_item() does now */
+__attribute__((noinline)) static void fill_item_tagged(DrawItem& item)
+{
+    item.view = nullptr;
+    item.animation = nullptr;
+    item.border_box = item.box;
+    switch (item.surface->type) {
+    case NAOLAND_SURFACE_TYPE_VIEW:
+        fill_surface_item<NAOLAND_SURFACE_TYPE_VIEW>(item);
+        break;
+    case NAOLAND_SURFACE_TYPE_LAYER:
+        fill_surface_item<NAOLAND_SURFACE_TYPE_LAYER>(item);
+        break;
+    case NAOLAND_SURFACE_TYPE_POPUP:
+        fill_surface_item<NAOLAND_SURFACE_TYPE_POPUP>(item);
+        break;
+    }
+}
+
+/* Nanoseconds per item, best of a few runs */
+template <typename Fill>
+static double measure(std::vector<DrawItem>& items, Fill fill)
+{
+    constexpr int RUNS = 5;
+    constexpr int ROUNDS = 200;
+    double best = 0.0;
+
+    for (int run = 0; run < RUNS; run++) {
+        auto const start = std::chrono::steady_clock::now();
+        for (int round = 0; round < ROUNDS; round++) {
+            for (auto& item : items) {
+                fill(item);
+            }
+        }
+        auto const end = std::chrono::steady_clock::now();
+
+        double const ns
+            = std::chrono::duration<double, std::nano>(end - start).count()
+            / (static_cast<double>(ROUNDS) * items.size());
+        if (run == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    return best;
+}
+
+int main()
+{
+    /* A busy desktop: mostly view buffers (including subsurfaces), some
+     * popups and layer surfaces, in scene order rather than grouped */
+    std::vector<std::unique_ptr<Surface>> surfaces;
+    std::mt19937 random(42);
+    for (int i = 0; i < 4096; i++) {
+        switch (random() % 8) {
+        case 0:
+            surfaces.push_back(std::make_unique<Popup>());
+            break;
+        case 1:
+            surfaces.push_back(std::make_unique<Layer>());
+            break;
+        case 2:
+            surfaces.push_back(std::make_unique<XWaylandView>());
+            break;
+        default:
+            surfaces.push_back(std::make_unique<XdgView>());
+            break;
+        }
+    }
+
+    std::vector<DrawItem> items;
+    for (auto const& surface : surfaces) {
+        items.push_back({ surface.get(), nullptr, nullptr, { 0, 0, 64, 64 },
+                          {} });
+    }
+
+    double const rtti = measure(items, fill_item_rtti);
+    double const tagged = measure(items, fill_item_tagged);
+
+    std::printf("virtual calls + dynamic_cast: %6.2f ns/item\n", rtti);
+    std::printf("type tag + specializations:   %6.2f ns/item\n", tagged);
+    std::printf("speedup:                      %6.2fx\n", rtti / tagged);
+
+    return 0;
+}
@@ -100,11 +100,24 @@ Config::Config()
     animation.enabled = true;
     animation.duration = 200;
     animation.play_percentage = 0.25;
+    animation.easing = ANIMATION_EASING_EASE_OUT_CUBIC;
     animation.window_animation.open = ANIMATION_ZOOM_FROM_BOTTOM;
     animation.window_animation.close = ANIMATION_ZOOM;
 
     // Tablet
     tablet.press_action = BTN_LEFT;
+
+    // Frame timing
+    frame_timing.render_late = false;
+    frame_timing.render_margin = 1;
+    frame_timing.hidden_frame_interval = 1000;
+
+    // Software rendering
+    software.render_threads = 0;
+
+    // Outputs
+    output.mode = NAOLAND_OUTPUT_MODE_PREFERRED;
+    output.hotplug_debounce = 100;
 }
 
 void int_to_float_array(uint32_t color, float dst[4])
@@ -16,6 +16,12 @@ enum CompositorCommand {
     NAOLAND_COMMAND_MOVE_TO_WORKSPACE,
 };
 
+enum OutputModePolicy {
+    NAOLAND_OUTPUT_MODE_PREFERRED,
+    NAOLAND_OUTPUT_MODE_HIGHEST_RESOLUTION,
+    NAOLAND_OUTPUT_MODE_HIGHEST_REFRESH,
+};
+
 enum KeyActionKind {
     NAOLAND_ACTION_COMMAND,
     NAOLAND_ACTION_SPAWN,
@@ -51,6 +57,7 @@ struct Config {
         bool enabled;
         int duration;
         float play_percentage;
+        AnimationEasing easing;
         struct {
             AnimationRole open;
             AnimationRole close;
@@ -61,6 +68,32 @@ struct Config {
         int press_action;
     } tablet;
 
+    struct {
+        /* Wait until shortly before the next vblank to render, based on how
+         * long previous frames took, so clients get a later deadline */
+        bool render_late;
+        /* Time in milliseconds kept in reserve on top of the render time */
+        int render_margin;
+        /* Interval in milliseconds at which surfaces not visible on any
+         * output still get frame callbacks, 0 withholds them entirely */
+        int hidden_frame_interval;
+    } frame_timing;
+
+    struct {
+        /* Threads compositing outputs with the pixman renderer, 0 picks one
+         * per CPU and 1 leaves it all to the render pass */
+        int render_threads;
+    } software;
+
+    struct {
+        /* Mode tried first when an output is connected, the others are tried
+         * in the same order if the output rejects it */
+        OutputModePolicy mode;
+        /* Time in milliseconds the layout waits for outputs to stop coming
+         * and going before it is rebuilt, 0 rebuilds it on every change */
+        int hotplug_debounce;
+    } output;
+
     Config();
 };
 
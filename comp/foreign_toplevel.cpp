@@ -4,6 +4,8 @@
 #include "server.hpp"
 #include "surface/view.hpp"
 
+#include <utility>
+
 static void
 foreign_toplevel_handle_request_maximize_notify(wl_listener* listener,
                                                 void* data)
@@ -79,8 +81,9 @@ static void foreign_toplevel_handle_set_rectangle_notify(wl_listener* listener,
 ForeignToplevelHandle::ForeignToplevelHandle(View& view) noexcept
     : listeners(*this)
     , view(view)
+    , server(view.get_server())
     , handle(*wlr_foreign_toplevel_handle_v1_create(
-          view.get_server().foreign_toplevel_manager))
+          server.foreign_toplevel_manager))
 {
     handle.data = this;
 
@@ -107,6 +110,7 @@ ForeignToplevelHandle::ForeignToplevelHandle(View& view) noexcept
 
 ForeignToplevelHandle::~ForeignToplevelHandle() noexcept
 {
+    server.dirty_toplevel_handles.erase(this);
     wlr_foreign_toplevel_handle_v1_destroy(&handle);
     wl_list_remove(&listeners.request_maximize.link);
     wl_list_remove(&listeners.request_minimize.link);
@@ -116,17 +120,91 @@ ForeignToplevelHandle::~ForeignToplevelHandle() noexcept
     wl_list_remove(&listeners.set_rectangle.link);
 }
 
-void ForeignToplevelHandle::set_title(char const* title) const
+/* Makes sure the handle gets flushed by the next output frame, or right away
+ * if there is no output to wait for */
+void ForeignToplevelHandle::mark_dirty()
+{
+    if (dirty) {
+        return;
+    }
+
+    dirty = true;
+    server.dirty_toplevel_handles.insert(this);
+
+    for (auto* output : server.outputs) {
+        if (output->wlr.enabled) {
+            wlr_output_schedule_frame(&output->wlr);
+            return;
+        }
+    }
+    flush_pending(server);
+}
+
+/* Sends whatever changed since the last flush and still differs from what
+ * clients know, wlroots follows up with a single done event */
+void ForeignToplevelHandle::flush()
 {
-    if (title != nullptr) {
-        wlr_foreign_toplevel_handle_v1_set_title(&handle, title);
+    dirty = false;
+
+    if (pending.title != sent.title) {
+        wlr_foreign_toplevel_handle_v1_set_title(&handle,
+                                                 pending.title.c_str());
+    }
+    if (pending.app_id != sent.app_id) {
+        wlr_foreign_toplevel_handle_v1_set_app_id(&handle,
+                                                  pending.app_id.c_str());
+    }
+    if (pending.maximized != sent.maximized) {
+        wlr_foreign_toplevel_handle_v1_set_maximized(&handle,
+                                                     pending.maximized);
+    }
+    if (pending.fullscreen != sent.fullscreen) {
+        wlr_foreign_toplevel_handle_v1_set_fullscreen(&handle,
+                                                      pending.fullscreen);
+    }
+    if (pending.minimized != sent.minimized) {
+        wlr_foreign_toplevel_handle_v1_set_minimized(&handle,
+                                                     pending.minimized);
+    }
+    if (pending.activated != sent.activated) {
+        wlr_foreign_toplevel_handle_v1_set_activated(&handle,
+                                                     pending.activated);
+    }
+    sent = pending;
+
+    /* wlroots ignores entering an output twice or leaving one not entered */
+    for (auto const& [output, entered] : pending_outputs) {
+        if (entered) {
+            wlr_foreign_toplevel_handle_v1_output_enter(&handle, output);
+        } else {
+            wlr_foreign_toplevel_handle_v1_output_leave(&handle, output);
+        }
     }
+    pending_outputs.clear();
 }
 
-void ForeignToplevelHandle::set_app_id(char const* app_id) const
+void ForeignToplevelHandle::flush_pending(Server& server)
 {
-    if (app_id != nullptr) {
-        wlr_foreign_toplevel_handle_v1_set_app_id(&handle, app_id);
+    auto const handles = std::move(server.dirty_toplevel_handles);
+    server.dirty_toplevel_handles.clear();
+    for (auto* handle : handles) {
+        handle->flush();
+    }
+}
+
+void ForeignToplevelHandle::set_title(char const* title)
+{
+    if (title != nullptr && pending.title != title) {
+        pending.title = title;
+        mark_dirty();
+    }
+}
+
+void ForeignToplevelHandle::set_app_id(char const* app_id)
+{
+    if (app_id != nullptr && pending.app_id != app_id) {
+        pending.app_id = app_id;
+        mark_dirty();
     }
 }
 
@@ -138,38 +216,59 @@ void ForeignToplevelHandle::set_parent(
         &handle, parent.has_value() ? &parent->get().handle : nullptr);
 }
 
-void ForeignToplevelHandle::set_placement(ViewPlacement const placement) const
+void ForeignToplevelHandle::set_placement(ViewPlacement const placement)
 {
     set_maximized(placement == VIEW_PLACEMENT_MAXIMIZED);
     set_fullscreen(placement == VIEW_PLACEMENT_FULLSCREEN);
 }
 
-void ForeignToplevelHandle::set_maximized(bool const maximized) const
+void ForeignToplevelHandle::set_maximized(bool const maximized)
 {
-    wlr_foreign_toplevel_handle_v1_set_maximized(&handle, maximized);
+    if (pending.maximized != maximized) {
+        pending.maximized = maximized;
+        mark_dirty();
+    }
 }
 
-void ForeignToplevelHandle::set_minimized(bool const minimized) const
+void ForeignToplevelHandle::set_minimized(bool const minimized)
 {
-    wlr_foreign_toplevel_handle_v1_set_minimized(&handle, minimized);
+    if (pending.minimized != minimized) {
+        pending.minimized = minimized;
+        mark_dirty();
+    }
 }
 
-void ForeignToplevelHandle::set_activated(bool const activated) const
+void ForeignToplevelHandle::set_activated(bool const activated)
 {
-    wlr_foreign_toplevel_handle_v1_set_activated(&handle, activated);
+    if (pending.activated != activated) {
+        pending.activated = activated;
+        mark_dirty();
+    }
+}
+
+void ForeignToplevelHandle::set_fullscreen(bool const fullscreen)
+{
+    if (pending.fullscreen != fullscreen) {
+        pending.fullscreen = fullscreen;
+        mark_dirty();
+    }
 }
 
-void ForeignToplevelHandle::set_fullscreen(bool const fullscreen) const
+void ForeignToplevelHandle::output_enter(Output const& output)
 {
-    wlr_foreign_toplevel_handle_v1_set_fullscreen(&handle, fullscreen);
+    pending_outputs[&output.wlr] = true;
+    mark_dirty();
 }
 
-void ForeignToplevelHandle::output_enter(Output const& output) const
+void ForeignToplevelHandle::output_leave(Output const& output)
 {
-    wlr_foreign_toplevel_handle_v1_output_enter(&handle, &output.wlr);
+    pending_outputs[&output.wlr] = false;
+    mark_dirty();
 }
 
-void ForeignToplevelHandle::output_leave(Output const& output) const
+/* Drops pending changes for an output about to be destroyed, wlroots takes
+ * care of the ones already sent */
+void ForeignToplevelHandle::forget_output(Output const& output)
 {
-    wlr_foreign_toplevel_handle_v1_output_leave(&handle, &output.wlr);
+    pending_outputs.erase(&output.wlr);
 }
@@ -4,6 +4,7 @@
 #include "types.hpp"
 
 #include <functional>
+#include <map>
 #include <optional>
 #include <string>
 
@@ -30,25 +31,50 @@ public:
 private:
     Listeners listeners;
 
+    /* Changes are only sent to clients once per output frame, see
+     * flush_pending(). `sent` is what clients were last told. */
+    struct State {
+        std::string title;
+        std::string app_id;
+        bool maximized = false;
+        bool fullscreen = false;
+        bool minimized = false;
+        bool activated = false;
+    };
+    State pending;
+    State sent;
+    /* Outputs entered (true) or left (false) since the last flush */
+    std::map<wlr_output*, bool> pending_outputs;
+    bool dirty = false;
+
+    void mark_dirty();
+    void flush();
+
 public:
     View& view;
+    /* Kept rather than asked to the view, which is already partly destroyed
+     * by the time the handle goes away */
+    Server& server;
     wlr_foreign_toplevel_handle_v1& handle;
 
     explicit ForeignToplevelHandle(View& view) noexcept;
     ~ForeignToplevelHandle() noexcept;
 
-    void set_title(char const* title) const;
-    void set_app_id(char const* app_id) const;
+    void set_title(char const* title);
+    void set_app_id(char const* app_id);
     void set_parent(
         std::optional<std::reference_wrapper<ForeignToplevelHandle const>>
             parent) const;
-    void set_placement(ViewPlacement placement) const;
-    void set_maximized(bool maximized) const;
-    void set_fullscreen(bool fullscreen) const;
-    void set_minimized(bool minimized) const;
-    void set_activated(bool activated) const;
-    void output_enter(Output const& output) const;
-    void output_leave(Output const& output) const;
+    void set_placement(ViewPlacement placement);
+    void set_maximized(bool maximized);
+    void set_fullscreen(bool fullscreen);
+    void set_minimized(bool minimized);
+    void set_activated(bool activated);
+    void output_enter(Output const& output);
+    void output_leave(Output const& output);
+    void forget_output(Output const& output);
+
+    static void flush_pending(Server& server);
 };
 
 #endif
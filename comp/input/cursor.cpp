@@ -12,8 +12,10 @@
 #include <iostream>
 
 #include "wlr-wrap-start.hpp"
+#include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor_shape_v1.h>
 #include <wlr/types/wlr_idle_notify_v1.h>
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_xcursor_manager.h>
@@ -33,9 +35,8 @@ void Cursor::process_resize(uint32_t const time) const
      * on one or two axes, but can also move the view if you resize from the top
      * or left edges (or top-left corner).
      *
-     * Note that I took some shortcuts here. In a more fleshed-out compositor,
-     * you'd wait for the client to prepare a buffer at the new size, then
-     * commit any movement that was prepared.
+     * The view only moves once the client has a buffer at the new size, see
+     * View::resize_interactive().
      */
     View& view = *seat.server.grabbed_view;
     wlr_box const min_size = view.get_min_size();
@@ -83,9 +84,7 @@ void Cursor::process_resize(uint32_t const time) const
     int32_t const new_y = new_height == view.current.height
         ? view.current.y
         : new_top - geo_box.y;
-    view.set_geometry(new_x, new_y, new_width, new_height);
-
-    view.update_outputs();
+    view.resize_interactive(new_x, new_y, new_width, new_height);
 }
 
 void Cursor::process_move(uint32_t const time)
@@ -103,6 +102,7 @@ void Cursor::process_move(uint32_t const time)
     view.set_position(new_x, new_y);
 
     view.update_outputs();
+    view.follow_output();
 }
 
 /* This event is forwarded by the cursor when a pointer emits an axis event,
@@ -112,6 +112,7 @@ static void cursor_axis_notify(wl_listener* listener, void* data)
     Cursor& cursor = naoland_container_of(listener, cursor, axis);
     auto const* event = static_cast<wlr_pointer_axis_event*>(data);
 
+    cursor.flush_motion();
     /* Notify the client with pointer focus of the axis event. */
     wlr_seat_pointer_notify_axis(cursor.seat.wlr, event->time_msec,
                                  event->orientation, event->delta,
@@ -126,6 +127,11 @@ static void cursor_frame_notify(wl_listener* listener, void*)
 {
     Cursor& cursor = naoland_container_of(listener, cursor, frame);
 
+    /* Queued motion is sent with its own frame event once it is applied */
+    if (cursor.motion_pending) {
+        return;
+    }
+
     /* Notify the client with pointer focus of the frame event. */
     wlr_seat_pointer_notify_frame(cursor.seat.wlr);
 }
@@ -145,8 +151,8 @@ static void cursor_motion_absolute_notify(wl_listener* listener, void* data)
     wlr_cursor_absolute_to_layout_coords(&cursor.wlr, &event->pointer->base,
                                          event->x, event->y, &lx, &ly);
 
-    double dx = lx - cursor.wlr.x;
-    double dy = ly - cursor.wlr.y;
+    double dx = lx - (cursor.wlr.x + cursor.pending_dx);
+    double dy = ly - (cursor.wlr.y + cursor.pending_dy);
     wlr_relative_pointer_manager_v1_send_relative_motion(
         cursor.relative_pointer_mgr, cursor.seat.wlr,
         static_cast<uint64_t>(event->time_msec) * 1000, dx, dy, dx, dy);
@@ -156,9 +162,7 @@ static void cursor_motion_absolute_notify(wl_listener* listener, void* data)
     }
 
     cursor.seat.apply_constraint(event->pointer, &dx, &dy);
-
-    wlr_cursor_move(&cursor.wlr, &event->pointer->base, dx, dy);
-    cursor.process_motion(event->time_msec);
+    cursor.queue_motion(&event->pointer->base, dx, dy, event->time_msec);
 }
 
 /* This event is forwarded by the cursor when a pointer emits a button event. */
@@ -167,6 +171,7 @@ static void cursor_button_notify(wl_listener* listener, void* data)
     Cursor& cursor = naoland_container_of(listener, cursor, button);
     auto const* event = static_cast<wlr_pointer_button_event*>(data);
 
+    cursor.flush_motion();
     wlr_idle_notifier_v1_notify_activity(cursor.seat.server.idle_notifier, cursor.seat.wlr);
 
     switch (event->state) {
@@ -198,9 +203,18 @@ static void cursor_motion_notify(wl_listener* listener, void* data)
     double dx = event->delta_x;
     double dy = event->delta_y;
     cursor.seat.apply_constraint(event->pointer, &dx, &dy);
+    cursor.queue_motion(&event->pointer->base, dx, dy, event->time_msec);
+}
 
-    wlr_cursor_move(&cursor.wlr, &event->pointer->base, dx, dy);
-    cursor.process_motion(event->time_msec);
+/* The device the pending motion came from is going away, apply the motion
+ * while its mapping can still be looked up */
+static void cursor_pending_device_destroy_notify(wl_listener* listener,
+                                                 void*)
+{
+    Cursor& cursor
+        = naoland_container_of(listener, cursor, pending_device_destroy);
+
+    cursor.flush_motion();
 }
 
 static void gesture_pinch_begin_notify(wl_listener* listener, void* data)
@@ -208,6 +222,8 @@ static void gesture_pinch_begin_notify(wl_listener* listener, void* data)
     Cursor& cursor = naoland_container_of(listener, cursor, gesture_pinch_begin);
     auto const* event = static_cast<wlr_pointer_pinch_begin_event*>(data);
 
+    cursor.flush_motion();
+
     wlr_pointer_gestures_v1_send_pinch_begin(cursor.pointer_gestures,
                                              cursor.seat.wlr, event->time_msec,
                                              event->fingers);
@@ -239,6 +255,8 @@ static void gesture_swipe_begin_notify(wl_listener* listener, void* data)
     Cursor& cursor = naoland_container_of(listener, cursor, gesture_swipe_begin);
     auto const* event = static_cast<wlr_pointer_swipe_begin_event*>(data);
 
+    cursor.flush_motion();
+
     wlr_pointer_gestures_v1_send_swipe_begin(cursor.pointer_gestures,
                                              cursor.seat.wlr, event->time_msec,
                                              event->fingers);
@@ -270,6 +288,8 @@ static void gesture_hold_begin_notify(wl_listener* listener, void* data)
     Cursor& cursor = naoland_container_of(listener, cursor, gesture_hold_begin);
     auto const* event = static_cast<wlr_pointer_hold_begin_event*>(data);
 
+    cursor.flush_motion();
+
     wlr_pointer_gestures_v1_send_hold_begin(cursor.pointer_gestures,
                                             cursor.seat.wlr, event->time_msec,
                                             event->fingers);
@@ -369,6 +389,34 @@ void Cursor::attach_input_device(wlr_input_device* device) const
     wlr_cursor_attach_input_device(&wlr, device);
 }
 
+/* Returns the surface under the cursor, skipping the scene lookup while the
+ * pointer moves within the part of a surface nothing else covers. */
+wlr_surface* Cursor::focus_at_cursor(double* sx, double* sy)
+{
+    Server& server = seat.server;
+
+    if (focus_surface != nullptr
+        && focus_generation == server.surface_index.generation()
+        && wlr_box_contains_point(&focus_box, wlr.x, wlr.y)) {
+        *sx = wlr.x - focus_x;
+        *sy = wlr.y - focus_y;
+        if (wlr_surface_point_accepts_input(focus_surface, *sx, *sy)) {
+            return focus_surface;
+        }
+    }
+
+    wlr_surface* surface = nullptr;
+    server.surface_at(wlr.x, wlr.y, &surface, sx, sy, &focus_box);
+
+    focus_surface = wlr_box_empty(&focus_box) ? nullptr : surface;
+    if (focus_surface != nullptr) {
+        focus_x = wlr.x - *sx;
+        focus_y = wlr.y - *sy;
+        focus_generation = server.surface_index.generation();
+    }
+    return surface;
+}
+
 void Cursor::process_motion(uint32_t const time)
 {
     wlr_idle_notifier_v1_notify_activity(seat.server.idle_notifier, seat.wlr);
@@ -386,10 +434,8 @@ void Cursor::process_motion(uint32_t const time)
 
     /* Otherwise, find the view under the pointer and send the event along. */
     double sx, sy;
-    wlr_surface* surface = nullptr;
-    Surface const* naoland_surface
-        = seat.server.surface_at(wlr.x, wlr.y, &surface, &sx, &sy);
-    if (naoland_surface == nullptr) {
+    wlr_surface* surface = focus_at_cursor(&sx, &sy);
+    if (surface == nullptr) {
         /* If there's no view under the cursor, set the cursor image to a
          * default. This is what makes the cursor image appear when you move it
          * around the screen, not over any views. */
@@ -408,7 +454,7 @@ void Cursor::process_motion(uint32_t const time)
          * the surface has already has pointer focus or if the client is already
          * aware of the coordinates passed.
          */
-        current_image = "";
+        current_image.clear();
         wlr_seat_pointer_notify_enter(seat.wlr, surface, sx, sy);
         wlr_seat_pointer_notify_motion(seat.wlr, time, sx, sy);
     } else {
@@ -418,6 +464,60 @@ void Cursor::process_motion(uint32_t const time)
     }
 }
 
+/* Motion events can arrive many times per frame with high polling rate
+ * devices. They are accumulated and applied once per output frame, hit-test,
+ * grab and all; only relative motion is sent to clients as it comes. */
+void Cursor::queue_motion(wlr_input_device* device, double const dx,
+                          double const dy, uint32_t const time)
+{
+    /* Motion from different devices may be mapped to different outputs and
+     * can't be summed up */
+    if (motion_pending && device != pending_device) {
+        flush_motion();
+    }
+
+    pending_dx += dx;
+    pending_dy += dy;
+    pending_time = time;
+    if (motion_pending) {
+        return;
+    }
+    motion_pending = true;
+    pending_device = device;
+    listeners.pending_device_destroy.notify
+        = cursor_pending_device_destroy_notify;
+    wl_signal_add(&device->events.destroy, &listeners.pending_device_destroy);
+
+    /* Without an output to get a frame from, apply it right away */
+    wlr_output* output = wlr_output_layout_output_at(
+        seat.server.output_layout, wlr.x, wlr.y);
+    if (output == nullptr || !output->enabled) {
+        flush_motion();
+        return;
+    }
+    wlr_output_schedule_frame(output);
+}
+
+void Cursor::flush_motion()
+{
+    if (!motion_pending) {
+        return;
+    }
+
+    double const dx = pending_dx;
+    double const dy = pending_dy;
+    wlr_input_device* device = pending_device;
+    motion_pending = false;
+    pending_dx = 0.0;
+    pending_dy = 0.0;
+    pending_device = nullptr;
+    wl_list_remove(&listeners.pending_device_destroy.link);
+
+    wlr_cursor_move(&wlr, device, dx, dy);
+    process_motion(pending_time);
+    wlr_seat_pointer_notify_frame(seat.wlr);
+}
+
 void Cursor::reset_mode()
 {
     if (mode != NAOLAND_CURSOR_PASSTHROUGH) {
@@ -464,6 +564,7 @@ void Cursor::reload_image() const
 
 void Cursor::emulate_button(uint32_t button, wlr_button_state state, uint32_t time_msec)
 {
+    flush_motion();
     wlr_idle_notifier_v1_notify_activity(seat.server.idle_notifier, seat.wlr);
 
     switch (state) {
@@ -549,6 +650,10 @@ void Cursor::button_release(uint32_t button, wlr_button_state state, uint32_t ti
 {
     Server& server = seat.server;
 
+    /* The last size of the grab must not wait on the client any longer */
+    if (mode == NAOLAND_CURSOR_RESIZE && server.grabbed_view != nullptr) {
+        server.grabbed_view->flush_resize();
+    }
     if (mode != NAOLAND_CURSOR_PASSTHROUGH) {
         reset_mode();
     }
@@ -559,6 +664,8 @@ void Cursor::button_release(uint32_t button, wlr_button_state state, uint32_t ti
 
 void Cursor::emulate_move_absolute(struct wlr_input_device *device, double x, double y, uint32_t time_msec)
 {
+    flush_motion();
+
     double lx, ly;
     wlr_cursor_absolute_to_layout_coords(&seat.cursor.wlr,
                                          device, x, y, &lx, &ly);
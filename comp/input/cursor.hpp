@@ -39,6 +39,7 @@ public:
         wl_listener gesture_hold_begin = {};
         wl_listener gesture_hold_end = {};
         wl_listener request_set_shape = {};
+        wl_listener pending_device_destroy = {};
         explicit Listeners(Cursor& parent) noexcept
             : parent(parent)
         {
@@ -50,6 +51,7 @@ private:
 
     void process_move(uint32_t time);
     void process_resize(uint32_t time) const;
+    wlr_surface* focus_at_cursor(double* sx, double* sy);
 
 public:
     Seat const& seat;
@@ -62,10 +64,30 @@ public:
     wlr_pointer_gestures_v1* pointer_gestures;
     std::string current_image;
 
+    /* Surface under the pointer as of the last lookup, reused as long as the
+     * pointer stays inside `focus_box` and no surface moves, see
+     * SurfaceIndex::generation() */
+    wlr_surface* focus_surface = nullptr;
+    wlr_box focus_box = {};
+    double focus_x = 0.0, focus_y = 0.0;
+    uint64_t focus_generation = 0;
+
+    /* Pointer motion received since the last output frame, see
+     * queue_motion() */
+    bool motion_pending = false;
+    double pending_dx = 0.0, pending_dy = 0.0;
+    uint32_t pending_time = 0;
+    /* Device the pending motion came from, so that it is applied with that
+     * device's output mapping */
+    wlr_input_device* pending_device = nullptr;
+
     explicit Cursor(Seat& seat) noexcept;
 
     void attach_input_device(wlr_input_device* device) const;
     void process_motion(uint32_t time);
+    void queue_motion(wlr_input_device* device, double dx, double dy,
+                      uint32_t time);
+    void flush_motion();
     void reset_mode();
     void warp_to_constraint(PointerConstraint const& constraint) const;
     void set_image(std::string const& name);
@@ -51,14 +51,9 @@ static bool handle_keybinding_for_symbol(Keybinding& keybinding,
             Server& server = keyboard.seat.server;
 
             switch (keybinding.action.compositor_command.kind) {
-            case NAOLAND_COMMAND_SWITCH_TASK: {
-                /* Cycle to the next view */
-                if (server.views.size() < 2) {
-                    break;
-                }
-                View* next_view = *server.views.begin()++;
-                server.focus_view(next_view);
-            } break;
+            case NAOLAND_COMMAND_SWITCH_TASK:
+                server.switch_task(keybinding.modifiers);
+                break;
             case NAOLAND_COMMAND_QUIT_SERVER:
                 wl_display_terminate(server.display);
                 break;
@@ -139,6 +134,9 @@ static void keyboard_handle_modifiers(wl_listener* listener, void*)
     /* Send modifiers to the client. */
     wlr_seat_keyboard_notify_modifiers(keyboard.seat.wlr,
                                        &keyboard.wlr.modifiers);
+
+    keyboard.seat.server.end_task_switch(
+        wlr_keyboard_get_modifiers(&keyboard.wlr));
 }
 
 Keyboard::Keyboard(Seat& seat, wlr_keyboard& keyboard) noexcept
@@ -182,8 +182,9 @@ void Seat::apply_constraint(wlr_pointer const* pointer, double* dx,
         return;
     }
 
-    double x = cursor.wlr.x;
-    double y = cursor.wlr.y;
+    /* Motion queued on the cursor counts as already applied */
+    double x = cursor.wlr.x + cursor.pending_dx;
+    double y = cursor.wlr.y + cursor.pending_dy;
 
     x -= server.focused_view->current.x;
     y -= server.focused_view->current.y;
@@ -1,20 +1,29 @@
 #include "output.hpp"
 
 #include "config.hpp"
+#include "foreign_toplevel.hpp"
+#include "input/seat.hpp"
 #include "server.hpp"
 #include "surface/layer.hpp"
 #include "surface/view.hpp"
 #include "types.hpp"
+#include "rendering/animation.hpp"
 #include "rendering/renderer.hpp"
+#include "rendering/software.hpp"
+#include "util.hpp"
 
+#include <ctime>
 #include <set>
 #include <utility>
+#include <vector>
 
 #include "wlr-wrap-start.hpp"
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
+#include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/util/log.h>
 #include <wlr/util/box.h>
 #include "wlr-wrap-end.hpp"
@@ -30,63 +39,335 @@ static void output_request_state_notify(wl_listener* listener, void* data)
     output.update_layout();
 }
 
-/* This function is called every time an output is ready to display a frame,
- * generally at the output's refresh rate (e.g. 60Hz). */
-static void output_frame_notify(wl_listener* listener, void*)
+/* Attach the client buffer of a fullscreen view directly to the primary plane,
+ * skipping the composition pass. This only happens when that buffer is the
+ * only thing visible on the output; anything else on top falls back to
+ * regular rendering. */
+static bool output_try_direct_scanout(Output& output,
+                                      wlr_scene_output* scene_output)
 {
-    Output& output = naoland_container_of(listener, output, frame);
+    if (!wlr_output_is_direct_scanout_allowed(&output.wlr)) {
+        return false;
+    }
 
-    wlr_scene_output* scene_output
-        = wlr_scene_get_scene_output(output.server.scene, &output.wlr);
+    wlr_box output_box = { scene_output->x, scene_output->y, 0, 0 };
+    wlr_output_effective_resolution(&output.wlr, &output_box.width,
+                                    &output_box.height);
 
-    if (scene_output == nullptr || output.is_leased || !output.wlr.enabled) {
-        return;
+    /* The draw list already holds what is shown on this output, with the
+     * same workspace filtering and culling the renderer uses */
+    Renderer::NodeRenderOptions options = {
+        .server = output.server,
+        .scene_output = scene_output,
+        .output_box = output.full_area,
+        .draw_list = &output.draw_list,
+    };
+    Renderer::update_draw_list(&output.server.scene->tree.node, &options);
+    if (output.draw_list.items.size() != 1) {
+        return false;
+    }
+
+    Renderer::DrawItem const& item = output.draw_list.items.front();
+    wlr_scene_buffer* scene_buffer = item.scene_buffer;
+    if (scene_buffer == nullptr || scene_buffer->buffer == nullptr
+        || item.view == nullptr) {
+        return false;
+    }
+    wlr_scene_surface* scene_surface
+        = wlr_scene_surface_try_from_buffer(scene_buffer);
+    if (scene_surface == nullptr) {
+        return false;
+    }
+
+    View const* view = item.view;
+    if (view->curr_placement != VIEW_PLACEMENT_FULLSCREEN
+        || view->animation.is_animating()) {
+        return false;
+    }
+
+    /* The buffer has to cover the output exactly, without any scaling,
+     * cropping, blending or transform the plane can't do on its own. A
+     * viewport scaling the buffer to the output still leaves its pixels at
+     * the wrong size, so its own size has to match the mode as well. */
+    if (!wlr_box_equal(&item.box, &output_box)
+        || scene_buffer->opacity != 1.0f
+        || scene_buffer->transform != output.wlr.transform
+        || scene_buffer->buffer->width != output.wlr.width
+        || scene_buffer->buffer->height != output.wlr.height) {
+        return false;
+    }
+
+    wlr_fbox const& src_box = scene_buffer->src_box;
+    if (!wlr_fbox_empty(&src_box)
+        && (src_box.x != 0 || src_box.y != 0
+            || src_box.width != scene_buffer->buffer->width
+            || src_box.height != scene_buffer->buffer->height)) {
+        return false;
+    }
+
+    wlr_output_state state;
+    wlr_output_state_init(&state);
+    wlr_output_state_set_buffer(&state, scene_buffer->buffer);
+
+    /* The test rejects buffers whose format or modifier can't be scanned out
+     * by the primary plane */
+    bool const ok = wlr_output_test_state(&output.wlr, &state)
+        && wlr_output_commit_state(&output.wlr, &state);
+    wlr_output_state_finish(&state);
+
+    if (!ok) {
+        return false;
     }
 
+    if (output.server.presentation != nullptr) {
+        wlr_presentation_surface_scanned_out_on_output(
+            output.server.presentation, scene_surface->surface, &output.wlr);
+    }
+
+    wlr_damage_ring_rotate(&scene_output->damage_ring);
+    return true;
+}
+
+static void output_render(Output& output, wlr_scene_output* scene_output)
+{
+    wlr_damage_ring& damage_ring = scene_output->damage_ring;
+
     wlr_output_state state;
     wlr_output_state_init(&state);
-    wlr_render_pass* pass
-        = wlr_output_begin_render_pass(&output.wlr, &state, nullptr, nullptr);
-
-    if (pass) {
-        // Clear screen
-        wlr_render_rect_options clear_options = {
-            .box = { .width = output.wlr.width, .height = output.wlr.height },
-            .color = { .3, .3, .3, 1 },
-        };
-        wlr_render_pass_add_rect(pass, &clear_options);
-
-        Renderer::NodeRenderOptions node_render_options = {
-            .server = output.server,
-            .render_pass = pass,
-            .scene_output = scene_output,
-            .transform = output.wlr.transform,
-        };
-        Renderer::render_scene_node(&scene_output->scene->tree.node,
-                                    &node_render_options);
 
+    /* Anything damaged while rendering (e.g. the next animation step) belongs
+     * to the next frame and must survive the damage ring rotation below. */
+    pixman_region32_t frame_damage;
+    pixman_region32_init(&frame_damage);
+    pixman_region32_copy(&frame_damage, &damage_ring.current);
+
+    int buffer_age = -1;
+    wlr_render_pass* pass = wlr_output_begin_render_pass(
+        &output.wlr, &state, &buffer_age, nullptr);
+    if (pass == nullptr) {
+        wlr_output_state_finish(&state);
+        pixman_region32_fini(&frame_damage);
+        return;
+    }
+
+    /* Only repaint what changed since this buffer was last displayed */
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    wlr_damage_ring_get_buffer_damage(&damage_ring, buffer_age, &damage);
+
+    Renderer::TileCompositor* compositor = output.server.tile_compositor;
+    std::vector<Renderer::RecordedOp> recording;
+
+    Renderer::NodeRenderOptions node_render_options = {
+        .server = output.server,
+        .render_pass = pass,
+        .scene_output = scene_output,
+        .transform = output.wlr.transform,
+        .output_box = output.full_area,
+        .damage = &damage,
+        .clear_color = { .3, .3, .3, 1 },
+        .draw_list = &output.draw_list,
+        .recording = compositor ? &recording : nullptr,
+    };
+    Renderer::render_scene_node(&scene_output->scene->tree.node,
+                                &node_render_options);
+
+    /* With pixman, the scene is composited over several threads straight
+     * into the buffer, which the render pass must let go of first. Whatever
+     * can't be done that way goes through the render pass as usual. */
+    if (compositor != nullptr) {
+        bool composited = false;
+        if (compositor->begin(recording)) {
+            wlr_render_pass_submit(pass);
+            composited = compositor->composite(state.buffer, &damage);
+            pass = wlr_renderer_begin_buffer_pass(output.server.renderer,
+                                                  state.buffer, nullptr);
+        }
+        compositor->end();
+
+        if (pass != nullptr && !composited) {
+            Renderer::replay_recording(pass, recording);
+        }
+        Renderer::clear_recording(recording);
+    }
+
+    if (pass != nullptr) {
+        wlr_output_add_software_cursors_to_render_pass(&output.wlr, pass,
+                                                        &damage);
         wlr_render_pass_submit(pass);
     }
-    wlr_output_commit_state(&output.wlr, &state);
+    pixman_region32_fini(&damage);
+
+    wlr_output_state_set_damage(&state, &frame_damage);
+
+    if (wlr_output_commit_state(&output.wlr, &state)) {
+        pixman_region32_t next_damage;
+        pixman_region32_init(&next_damage);
+        pixman_region32_subtract(&next_damage, &damage_ring.current,
+                                 &frame_damage);
+
+        wlr_damage_ring_rotate(&damage_ring);
+        if (wlr_damage_ring_add(&damage_ring, &next_damage)) {
+            wlr_output_schedule_frame(&output.wlr);
+        }
+        pixman_region32_fini(&next_damage);
+    }
     wlr_output_state_finish(&state);
+    pixman_region32_fini(&frame_damage);
+}
+
+/* Render whatever changed and answer the clients waiting on a frame
+ * callback. Called right from the frame event, or from the repaint timer when
+ * rendering is pushed back towards the next vblank. */
+void Output::repaint()
+{
+    if (scene_output == nullptr || is_leased || !wlr.enabled) {
+        return;
+    }
+
+    /* Catch motion that came in while a late render was waiting */
+    server.seat->cursor.flush_motion();
+
+    /* Animations covering this output are stepped to when this frame shows up
+     * on screen, which damages them and keeps frames coming until they end.
+     * A finishing animation can run callbacks that end or destroy other
+     * animations, so step a copy and skip the ones gone since. */
+    int64_t const present_time = predict_presentation_time();
+    std::vector<Animation*> const animations(server.animations.begin(),
+                                             server.animations.end());
+    for (auto* animation : animations) {
+        if (server.animations.contains(animation)
+            && animation->is_on_output(*this)) {
+            animation->update(present_time);
+        }
+    }
+
+    /* When nothing changed, skip the render and the commit. No new frame
+     * event follows until something damages the output again, but clients
+     * waiting on a frame callback are still answered below. */
+    if (needs_redraw()) {
+        int64_t const start_nsec = get_monotonic_time_nsec();
+
+        if (output_try_direct_scanout(*this, scene_output)) {
+            scanned_out = true;
+        } else {
+            if (scanned_out) {
+                /* The swapchain buffers are stale after scanning out */
+                wlr_damage_ring_add_whole(&scene_output->damage_ring);
+                scanned_out = false;
+            }
+            output_render(*this, scene_output);
+        }
+
+        /* Follow slower frames right away, forget them slowly */
+        int64_t const elapsed = get_monotonic_time_nsec() - start_nsec;
+        render_time_nsec = elapsed > render_time_nsec
+            ? elapsed
+            : (render_time_nsec * 7 + elapsed) / 8;
+    }
 
     timespec now = {};
-    timespec_get(&now, TIME_UTC);
+    clock_gettime(CLOCK_MONOTONIC, &now);
     wlr_scene_output_send_frame_done(scene_output, &now);
 }
 
+/* How long to wait before rendering so that the frame is done just in time
+ * for the next vblank, in milliseconds */
+static int output_get_render_delay(Output const& output)
+{
+    Config const& config = output.server.config;
+    if (!config.frame_timing.render_late || output.refresh_nsec <= 0
+        || output.last_present_nsec == 0) {
+        return 0;
+    }
+
+    int64_t const now = get_monotonic_time_nsec();
+    int64_t const delay_nsec = output.predict_presentation_time() - now
+        - output.render_time_nsec
+        - static_cast<int64_t>(config.frame_timing.render_margin) * 1000000;
+    return delay_nsec > 0 ? static_cast<int>(delay_nsec / 1000000) : 0;
+}
+
+static int output_repaint_timer_notify(void* data)
+{
+    static_cast<Output*>(data)->repaint();
+    return 0;
+}
+
+/* This function is called every time an output is ready to display a frame,
+ * generally at the output's refresh rate (e.g. 60Hz). Frames are only
+ * scheduled when something on the output changed, see Output::add_damage. */
+static void output_frame_notify(wl_listener* listener, void*)
+{
+    Output& output = naoland_container_of(listener, output, frame);
+
+    /* Pointer motion is applied once per frame, before deciding whether
+     * anything needs to be drawn */
+    output.server.seat->cursor.flush_motion();
+    ForeignToplevelHandle::flush_pending(output.server);
+
+    int const delay = output.needs_redraw()
+        ? output_get_render_delay(output)
+        : 0;
+    if (delay > 0 && output.repaint_timer != nullptr) {
+        wl_event_source_timer_update(output.repaint_timer, delay);
+        return;
+    }
+
+    output.repaint();
+}
+
+static void output_present_notify(wl_listener* listener, void* data)
+{
+    Output& output = naoland_container_of(listener, output, present);
+    auto const* event = static_cast<wlr_output_event_present*>(data);
+
+    if (!event->presented || event->when == nullptr) {
+        return;
+    }
+
+    output.last_present_nsec = timespec_to_nsec(event->when);
+    output.refresh_nsec = event->refresh;
+}
+
 static void output_destroy_notify(wl_listener* listener, void*)
 {
     Output& output = naoland_container_of(listener, output, destroy);
 
     output.server.outputs.erase(&output);
-    for (auto const* layer : std::as_const(output.layers)) {
+    for (auto* handle : output.server.dirty_toplevel_handles) {
+        handle->forget_output(output);
+    }
+    /* Destroying a layer surface removes it from the set right away */
+    output.destroying = true;
+    std::vector<Layer*> const layers(output.layers.begin(),
+                                     output.layers.end());
+    for (auto const* layer : layers) {
         wlr_layer_surface_v1_destroy(&layer->layer_surface);
     }
 
     delete &output;
 }
 
+/* Moves every view of `from` to `to`, keeping their order */
+static void move_views(Workspace& from, Workspace& to)
+{
+    std::vector<View*> views;
+    for (View* view = from.views; view != nullptr; view = view->mru_next) {
+        views.push_back(view);
+    }
+
+    for (auto it = views.rbegin(); it != views.rend(); ++it) {
+        (*it)->enter_workspace(to);
+        (*it)->get_server().surface_index.mark_dirty(**it);
+    }
+    if (!views.empty()) {
+        Server& server = views.front()->get_server();
+        server.scene_generation++;
+        server.surface_index.mark_restacked();
+    }
+}
+
 Output::Output(Server& server, wlr_output& wlr) noexcept
     : listeners(*this)
     , server(server)
@@ -94,58 +375,270 @@ Output::Output(Server& server, wlr_output& wlr) noexcept
 {
     wlr.data = this;
 
-    wlr_output_init_render(&wlr, server.allocator, server.renderer);
-
-    wlr_output_state state = {};
-    wlr_output_state_init(&state);
-    wlr_output_state_set_enabled(&state, true);
-
-    wlr_output_mode* mode = wlr_output_preferred_mode(&wlr);
-    if (mode != nullptr) {
-        wlr_output_state_set_mode(&state, mode);
-    }
-
-    wlr_output_commit_state(&wlr, &state);
-    wlr_output_state_finish(&state);
+    repaint_timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop(server.display), output_repaint_timer_notify,
+        this);
 
     listeners.request_state.notify = output_request_state_notify;
     wl_signal_add(&wlr.events.request_state, &listeners.request_state);
     listeners.frame.notify = output_frame_notify;
     wl_signal_add(&wlr.events.frame, &listeners.frame);
+    listeners.present.notify = output_present_notify;
+    wl_signal_add(&wlr.events.present, &listeners.present);
     listeners.destroy.notify = output_destroy_notify;
     wl_signal_add(&wlr.events.destroy, &listeners.destroy);
 
+    /* The output layout utility automatically adds a wl_output global to the
+     * display, which Wayland clients can see to find out information about
+     * the output (such as DPI, scale factor, manufacturer, etc). */
     wlr_output_layout_output* layout_output
         = wlr_output_layout_add_auto(server.output_layout, &wlr);
-    wlr_scene_output* scene_output
-        = wlr_scene_output_create(server.scene, &wlr);
+    scene_output = wlr_scene_output_create(server.scene, &wlr);
     wlr_scene_output_layout_add_output(server.scene_layout, layout_output,
                                        scene_output);
+
+    active_workspace = &get_workspace(1);
+    wlr_scene_node_set_enabled(&active_workspace->scene_tree->node, true);
+    move_views(server.unassigned, *active_workspace);
 }
 
 Output::~Output() noexcept
 {
     wl_list_remove(&listeners.request_state.link);
     wl_list_remove(&listeners.frame.link);
+    wl_list_remove(&listeners.present.link);
     wl_list_remove(&listeners.destroy.link);
+
+    /* Views go to whatever another output is showing. Emptied workspaces
+     * are released by the move, as none is active anymore. */
+    Workspace& target = server.outputs.empty()
+        ? server.unassigned
+        : *(*server.outputs.begin())->active_workspace;
+    active_workspace = nullptr;
+    std::vector<Workspace*> remaining;
+    for (auto const& [number, workspace] : workspaces) {
+        remaining.push_back(workspace);
+    }
+    for (auto* workspace : remaining) {
+        move_views(*workspace, target);
+    }
+    for (auto const& [number, workspace] : workspaces) {
+        wlr_scene_node_destroy(&workspace->scene_tree->node);
+        delete workspace;
+    }
+
+    if (repaint_timer != nullptr) {
+        wl_event_source_remove(repaint_timer);
+    }
 }
 
-void Output::update_layout()
+/* Follows the output's position and size in the layout. This is cheap and
+ * done as soon as the layout changes, so that rendering and culling never use
+ * a stale area; arranging what is on the output is left to update_layout().
+ * Returns whether the area changed. */
+bool Output::update_full_area()
 {
     wlr_scene_output const* scene_output
         = wlr_scene_get_scene_output(server.scene, &wlr);
     if (scene_output == nullptr) {
-        return;
+        return false;
     }
 
+    wlr_box const previous_full_area = full_area;
     full_area.x = scene_output->x;
     full_area.y = scene_output->y;
     wlr_output_effective_resolution(&wlr, &full_area.width, &full_area.height);
+    if (wlr_box_equal(&previous_full_area, &full_area)) {
+        return false;
+    }
 
+    server.scene_generation++;
+    damage_whole();
+    return true;
+}
+
+void Output::update_layout()
+{
+    if (wlr_scene_get_scene_output(server.scene, &wlr) == nullptr) {
+        return;
+    }
+
+    update_full_area();
+    arrange_layers();
+
+    server.scene_generation++;
+    /* Layer surfaces and everything nested in them may have moved */
+    server.surface_index.mark_all_dirty();
+    damage_whole();
+}
+
+/* Places the layer surfaces and computes the usable area they leave. Each
+ * layer only sees the area left by the ones before it, so a layer is only
+ * configured again when that area or its own state changed; otherwise the area
+ * it left last time still holds. With `force`, or when full_area changed since
+ * the last call, every layer is. */
+void Output::arrange_layers(bool force)
+{
+    /* The layers have not seen the new area yet */
+    if (!wlr_box_equal(&arranged_full_area, &full_area)) {
+        force = true;
+        arranged_full_area = full_area;
+    }
+
+    wlr_box const previous_usable_area = usable_area;
     usable_area = full_area;
 
-    for (auto const* layer : std::as_const(layers)) {
+    for (auto* layer : std::as_const(layers)) {
+        if (!force && layer->arranged
+            && wlr_box_equal(&usable_area, &layer->usable_before)
+            && !layer->arrangement_changed()) {
+            usable_area = layer->usable_after;
+            continue;
+        }
+
+        layer->usable_before = usable_area;
         wlr_scene_layer_surface_v1_configure(layer->scene_layer_surface,
                                              &full_area, &usable_area);
+        layer->usable_after = usable_area;
+        layer->arranged_state = layer->layer_surface.current;
+        layer->arranged = true;
+
+        server.scene_generation++;
+        server.surface_index.mark_dirty(*layer);
+    }
+
+    if (wlr_box_equal(&previous_usable_area, &usable_area)) {
+        return;
+    }
+
+    /* Views maximized to the old usable area follow it */
+    for (auto const& [number, workspace] : workspaces) {
+        for (View* view = workspace->views; view != nullptr;
+             view = view->mru_next) {
+            if (view->curr_placement == VIEW_PLACEMENT_MAXIMIZED
+                && wlr_box_equal(&view->current, &previous_usable_area)) {
+                view->set_geometry(usable_area.x, usable_area.y,
+                                   usable_area.width, usable_area.height);
+                view->update_outputs();
+            }
+        }
+    }
+}
+
+/* Returns workspace `number` of this output, creating it hidden if needed */
+Workspace& Output::get_workspace(int const number)
+{
+    auto const it = workspaces.find(number);
+    if (it != workspaces.end()) {
+        return *it->second;
+    }
+
+    auto* workspace = new Workspace {
+        .number = number,
+        .output = this,
+        .scene_tree = wlr_scene_tree_create(
+            server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL]),
+    };
+    wlr_scene_node_set_enabled(&workspace->scene_tree->node, false);
+    workspaces.emplace(number, workspace);
+    return *workspace;
+}
+
+/* Only the workspace being left and the one shown are touched, however many
+ * others there are */
+void Output::switch_workspace(int const number)
+{
+    if (number < 1) {
+        return;
+    }
+
+    Workspace& target = get_workspace(number);
+    Workspace* previous = active_workspace;
+    if (&target == previous) {
+        return;
+    }
+
+    wlr_scene_node_set_enabled(&target.scene_tree->node, true);
+    active_workspace = &target;
+    if (previous != nullptr) {
+        wlr_scene_node_set_enabled(&previous->scene_tree->node, false);
+        /* Views hidden must stop being found under the pointer */
+        for (View* view = previous->views; view != nullptr;
+             view = view->mru_next) {
+            server.surface_index.mark_dirty(*view);
+        }
+        release_workspace(*previous);
+    }
+
+    server.task_switch_view = nullptr;
+    server.scene_generation++;
+    /* Bounds of the views shown may have been computed while hidden */
+    for (View* view = target.views; view != nullptr; view = view->mru_next) {
+        server.surface_index.mark_dirty(*view);
+    }
+    damage_whole();
+}
+
+/* Destroys `workspace` if nothing is left in it and it is not shown */
+void Output::release_workspace(Workspace& workspace)
+{
+    if (&workspace == active_workspace || workspace.views != nullptr
+        || !wl_list_empty(&workspace.scene_tree->children)) {
+        return;
+    }
+
+    workspaces.erase(workspace.number);
+    wlr_scene_node_destroy(&workspace.scene_tree->node);
+    delete &workspace;
+}
+
+bool Output::needs_redraw() const
+{
+    if (scene_output == nullptr) {
+        return false;
     }
+
+    return wlr.needs_frame
+        || pixman_region32_not_empty(&scene_output->damage_ring.current);
+}
+
+/* When the next vblank is expected, in CLOCK_MONOTONIC nanoseconds. Falls
+ * back to the current time until the output presented a frame. */
+int64_t Output::predict_presentation_time() const
+{
+    int64_t const now = get_monotonic_time_nsec();
+    if (refresh_nsec <= 0 || last_present_nsec == 0) {
+        return now;
+    }
+
+    /* The output may have been idle for a while, vblanks keep happening at
+     * the same pace in the meantime */
+    int64_t const since_present = now - last_present_nsec;
+    return last_present_nsec
+        + (since_present / refresh_nsec + 1) * refresh_nsec;
+}
+
+/* Damage an area of this output, given in layout coordinates. */
+void Output::add_damage(wlr_box const& box) const
+{
+    if (scene_output == nullptr) {
+        return;
+    }
+
+    wlr_box local = box;
+    local.x -= scene_output->x;
+    local.y -= scene_output->y;
+    if (wlr_damage_ring_add_box(&scene_output->damage_ring, &local)) {
+        wlr_output_schedule_frame(&wlr);
+    }
+}
+
+void Output::damage_whole() const
+{
+    if (scene_output == nullptr) {
+        return;
+    }
+
+    wlr_damage_ring_add_whole(&scene_output->damage_ring);
+    wlr_output_schedule_frame(&wlr);
 }
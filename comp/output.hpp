@@ -2,8 +2,11 @@
 #define NAOLAND_OUTPUT_HPP
 
 #include "types.hpp"
+#include "rendering/renderer.hpp"
 
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <set>
 
 #include "wlr-wrap-start.hpp"
@@ -19,6 +22,7 @@ public:
         wl_listener enable = {};
         wl_listener request_state = {};
         wl_listener frame = {};
+        wl_listener present = {};
         wl_listener destroy = {};
         explicit Listeners(Output& parent) noexcept
             : parent(parent)
@@ -35,13 +39,38 @@ public:
     wlr_scene_output* scene_output = nullptr;
     wlr_box full_area = {};
     wlr_box usable_area = {};
+    /* full_area as of the last time the layers were arranged */
+    wlr_box arranged_full_area = {};
     std::set<Layer*> layers;
+    /* Workspaces that exist on this output, by number */
+    std::map<int, Workspace*> workspaces;
+    Workspace* active_workspace = nullptr;
     bool is_leased = false;
+    /* Set while the output tears down what is left on it */
+    bool destroying = false;
+    bool scanned_out = false;
+    Renderer::DrawList draw_list;
+    /* Timing of the last presented frame, in CLOCK_MONOTONIC nanoseconds */
+    int64_t last_present_nsec = 0;
+    int refresh_nsec = 0;
+    /* Recent worst case of how long a frame took to render and commit */
+    int64_t render_time_nsec = 0;
+    wl_event_source* repaint_timer = nullptr;
 
     Output(Server& server, wlr_output& wlr) noexcept;
     ~Output() noexcept;
 
+    bool update_full_area();
     void update_layout();
+    void arrange_layers(bool force = false);
+    Workspace& get_workspace(int number);
+    void switch_workspace(int number);
+    void release_workspace(Workspace& workspace);
+    void repaint();
+    [[nodiscard]] bool needs_redraw() const;
+    [[nodiscard]] int64_t predict_presentation_time() const;
+    void add_damage(wlr_box const& box) const;
+    void damage_whole() const;
 };
 
 #endif
@@ -1,80 +1,263 @@
 #include "animation.hpp"
 
+#include "output.hpp"
+#include "rendering/renderer.hpp"
 #include "server.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <utility>
+
+static double apply_easing(AnimationEasing easing, double t)
+{
+    switch (easing) {
+    case ANIMATION_EASING_LINEAR:
+        return t;
+    case ANIMATION_EASING_EASE_OUT_CUBIC: {
+        double const inv = 1.0 - t;
+        return 1.0 - inv * inv * inv;
+    }
+    case ANIMATION_EASING_EASE_IN_OUT_CUBIC:
+        if (t < 0.5) {
+            return 4.0 * t * t * t;
+        } else {
+            double const inv = -2.0 * t + 2.0;
+            return 1.0 - inv * inv * inv / 2.0;
+        }
+    }
+
+    return t;
+}
 
 Animation::Animation(Surface& surface)
     : surface(surface)
 {
 }
 
+/* The surface is already gone by the time its members are destroyed, hence
+ * the server remembered from start() */
+Animation::~Animation()
+{
+    if (server != nullptr) {
+        server->animations.erase(this);
+    }
+    drop_snapshot();
+}
+
 void Animation::start(AnimationOptions options)
 {
     assert(options.role != 0 && "Animation role cannot be 0");
 
-    if (!surface.get_server().config.animation.enabled) return;
+    server = &surface.get_server();
+    Config const& config = server->config;
+    if (!config.animation.enabled) return;
+
+    /* Unless told otherwise, only the last play_percentage of the timeline is
+     * played, in that much of the configured duration */
+    double const span = options.ignore_play_percentage
+        ? 1.0
+        : config.animation.play_percentage;
 
-    start_time = get_time_milli();
+    start_time = get_monotonic_time_nsec();
+    duration = static_cast<int64_t>(config.animation.duration * span * 1000000);
+    start_factor = 1.0 - span;
+    progress = 0;
+    area = {};
+    drop_snapshot();
+    snapshot_taken = false;
+    easing = config.animation.easing;
     animating = true;
     this->options = options;
+
+    server->animations.insert(this);
+
+    /* Taken right away, so a closing view can still be drawn once its
+     * client destroys its buffers. Views that are just being mapped have
+     * nothing to render yet, update() tries again for them. */
+    take_snapshot();
+
+    /* Kick off frames on the outputs the surface is on. A surface that is
+     * shown nowhere has nothing to fade out, no output would ever step it. */
+    track_area();
+    if (wlr_box_empty(&area) && options.kind == ANIMATION_FADE_OUT) {
+        update(start_time + duration);
+        return;
+    }
+    damage();
 }
 
-double Animation::get_factor()
+/* Grows the area the animation covered so far with wherever the surface is
+ * now. Surfaces that are just being mapped have no bounds yet, hence the
+ * calls from both start() and the outputs. */
+void Animation::track_area()
 {
-    return animation_factor;
+    wlr_box const bounds = surface.get_cached_bounds();
+    if (wlr_box_empty(&bounds)) {
+        return;
+    }
+
+    if (wlr_box_empty(&area)) {
+        area = bounds;
+        return;
+    }
+
+    int const x1 = std::min(area.x, bounds.x);
+    int const y1 = std::min(area.y, bounds.y);
+    int const x2 = std::max(area.x + area.width, bounds.x + bounds.width);
+    int const y2 = std::max(area.y + area.height, bounds.y + bounds.height);
+    area = { x1, y1, x2 - x1, y2 - y1 };
 }
 
-bool Animation::is_animating()
+/* Schedules frames on the outputs the animation covers, and on those only */
+void Animation::damage() const
 {
-    return animating;
+    if (wlr_box_empty(&area)) {
+        return;
+    }
+
+    for (auto const* output : std::as_const(server->outputs)) {
+        wlr_box intersection;
+        if (wlr_box_intersection(&intersection, &area, &output->full_area)) {
+            output->add_damage(area);
+        }
+    }
 }
 
-AnimationRole Animation::get_role()
+/* Only done once the surface has bounds, which surfaces that are just being
+ * mapped don't have yet when the animation starts */
+void Animation::take_snapshot()
 {
-    return options.role;
+    if (surface.type != NAOLAND_SURFACE_TYPE_VIEW
+        || surface.scene_tree == nullptr) {
+        snapshot_taken = true;
+        return;
+    }
+
+    wlr_box const bounds = surface.get_bounds();
+    int lx, ly;
+    if (wlr_box_empty(&bounds)
+        || !wlr_scene_node_coords(&surface.scene_tree->node, &lx, &ly)) {
+        return;
+    }
+
+    snapshot_taken = true;
+    snapshot = Renderer::render_snapshot(*server, surface.scene_tree, bounds);
+    if (snapshot != nullptr) {
+        snapshot_box = bounds;
+        snapshot_offset_x = bounds.x - lx;
+        snapshot_offset_y = bounds.y - ly;
+        server->scene_generation++;
+    }
 }
 
-void Animation::update()
+/* Keeps the snapshot where the view is while the view is still around, and
+ * where it was last seen once it is gone */
+void Animation::follow_surface()
 {
-    if (!animating)
+    int lx, ly;
+    if (snapshot == nullptr || surface.scene_tree == nullptr
+        || !wlr_scene_node_coords(&surface.scene_tree->node, &lx, &ly)) {
         return;
+    }
 
-    auto config = surface.get_server().config;
-    float play_percentage = 1.0f
-        - (options.ignore_play_percentage ? 1.0f
-                                          : config.animation.play_percentage);
+    snapshot_box.x = lx + snapshot_offset_x;
+    snapshot_box.y = ly + snapshot_offset_y;
+}
 
-    switch (options.kind) {
-    case ANIMATION_FADE_IN: {
-        auto now = get_time_milli();
-        auto duration = now - start_time
-            + config.animation.duration * play_percentage;
+void Animation::drop_snapshot()
+{
+    if (snapshot == nullptr) {
+        return;
+    }
 
-        animation_factor = static_cast<float>(duration) / config.animation.duration;
+    wlr_texture_destroy(snapshot);
+    snapshot = nullptr;
+    server->scene_generation++;
+}
 
-        if (animation_factor >= 1) {
-            if (options.callback)
-                options.callback(options.callback_data);
+wlr_texture* Animation::get_snapshot() const
+{
+    return snapshot;
+}
 
-            animation_factor = 1.0f;
-            animating = false;
-        }
-    } break;
-    case ANIMATION_FADE_OUT: {
-        auto now = get_time_milli();
-        auto duration = now - start_time;
+wlr_box Animation::get_snapshot_box()
+{
+    follow_surface();
+    return snapshot_box;
+}
 
-        animation_factor = 1.0f - static_cast<float>(duration) / config.animation.duration;
+bool Animation::is_on_output(Output const& output)
+{
+    track_area();
+
+    wlr_box intersection;
+    return wlr_box_intersection(&intersection, &area, &output.full_area);
+}
+
+double Animation::get_factor() const
+{
+    return get_factor(easing);
+}
 
-        if (animation_factor <= play_percentage) {
-            if (options.callback)
-                options.callback(options.callback_data);
+double Animation::get_factor(AnimationEasing curve) const
+{
+    double const eased = apply_easing(curve, progress);
 
-            animation_factor = 0;
-            animating = false;
+    switch (options.kind) {
+    case ANIMATION_FADE_IN:
+        return start_factor + eased * (1.0 - start_factor);
+    case ANIMATION_FADE_OUT:
+        /* Nothing is left to show once a fade out is over */
+        if (!animating) {
+            return 0;
         }
-    } break;
+        return 1.0 - eased * (1.0 - start_factor);
+    }
+
+    return 1.0;
+}
+
+bool Animation::is_animating() const
+{
+    return animating;
+}
+
+AnimationRole Animation::get_role() const
+{
+    return options.role;
+}
+
+/* Moves the timeline to `time`, in CLOCK_MONOTONIC nanoseconds. Outputs
+ * presenting out of phase may step the same animation with slightly different
+ * times, so it never goes backwards. */
+void Animation::update(int64_t time)
+{
+    if (!animating)
+        return;
+
+    /* Fade outs keep whatever start() got, the surface may already be
+     * going away */
+    if (!snapshot_taken && options.kind == ANIMATION_FADE_IN) {
+        take_snapshot();
+    }
+    follow_surface();
+
+    double const elapsed = static_cast<double>(time - start_time);
+    double const next = duration > 0
+        ? std::clamp(elapsed / static_cast<double>(duration), 0.0, 1.0)
+        : 1.0;
+    progress = std::max(progress, next);
+
+    track_area();
+    damage();
+
+    if (progress >= 1.0) {
+        animating = false;
+        server->animations.erase(this);
+        drop_snapshot();
+
+        if (options.callback)
+            options.callback(options.callback_data);
     }
 }
@@ -5,6 +5,11 @@
 
 #include <cstdint>
 
+#include "wlr-wrap-start.hpp"
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/box.h>
+#include "wlr-wrap-end.hpp"
+
 typedef void (*AnimationFinishCallback)(void*);
 
 enum AnimationKind {
@@ -18,6 +23,12 @@ enum AnimationRole {
     ANIMATION_FADE,
 };
 
+enum AnimationEasing {
+    ANIMATION_EASING_LINEAR,
+    ANIMATION_EASING_EASE_OUT_CUBIC,
+    ANIMATION_EASING_EASE_IN_OUT_CUBIC,
+};
+
 struct AnimationOptions {
     AnimationKind kind;
     AnimationRole role;
@@ -26,22 +37,52 @@ struct AnimationOptions {
     bool ignore_play_percentage;
 };
 
+/* A single timeline, started by start() and stepped by update() with the time
+ * the next frame is going to be presented at. Several properties (e.g. scale
+ * and alpha) can be sampled from the same timeline with different easings.
+ * While running, it only schedules frames on the outputs it covers. */
 class Animation {
 private:
-    bool animating;
-    int64_t start_time;
-    double animation_factor = 0;
-    AnimationOptions options;
+    bool animating = false;
+    /* CLOCK_MONOTONIC nanoseconds */
+    int64_t start_time = 0;
+    int64_t duration = 0;
+    /* Linear progress through the timeline, from 0 to 1 */
+    double progress = 0;
+    /* Factor the timeline starts from when only the end of it is played */
+    double start_factor = 0;
+    AnimationOptions options = {};
+    AnimationEasing easing = ANIMATION_EASING_LINEAR;
+    /* Layout-space union of the surface's bounds since start() */
+    wlr_box area = {};
+    /* Views are drawn from a texture rendered when the animation starts */
+    wlr_texture* snapshot = nullptr;
+    wlr_box snapshot_box = {};
+    /* Position of the snapshot relative to the surface's scene tree */
+    int snapshot_offset_x = 0, snapshot_offset_y = 0;
+    bool snapshot_taken = false;
     Surface& surface;
+    Server* server = nullptr;
+
+    void track_area();
+    void damage() const;
+    void take_snapshot();
+    void follow_surface();
+    void drop_snapshot();
 
 public:
     Animation(Surface& surface);
+    ~Animation();
 
     void start(AnimationOptions options);
-    double get_factor();
-    bool is_animating();
-    AnimationRole get_role();
-    void update();
+    [[nodiscard]] double get_factor() const;
+    [[nodiscard]] double get_factor(AnimationEasing curve) const;
+    [[nodiscard]] bool is_animating() const;
+    [[nodiscard]] AnimationRole get_role() const;
+    [[nodiscard]] bool is_on_output(Output const& output);
+    [[nodiscard]] wlr_texture* get_snapshot() const;
+    [[nodiscard]] wlr_box get_snapshot_box();
+    void update(int64_t time);
 };
 
 #endif
@@ -1,16 +1,26 @@
 #include "renderer.hpp"
 
+#include "output.hpp"
+#include "server.hpp"
 #include "rendering/animation.hpp"
 #include "surface/surface.hpp"
 #include "surface/view.hpp"
 #include "surface/popup.hpp"
 #include "util.hpp"
 
+#include <cstring>
 #include <ctime>
 #include <cassert>
+#include <utility>
+#include <vector>
 
 #include "wlr-wrap-start.hpp"
+#include <drm_fourcc.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include "wlr-wrap-end.hpp"
 
@@ -36,6 +46,10 @@ static wlr_box scale_box(wlr_box box, double scale, bool from_bottom = false)
 static wlr_texture* scene_buffer_get_texture(wlr_scene_buffer* scene_buffer,
                                              wlr_renderer* renderer)
 {
+    if (scene_buffer->buffer == nullptr) {
+        return nullptr;
+    }
+
     wlr_client_buffer* client_buffer
         = wlr_client_buffer_get(scene_buffer->buffer);
     if (client_buffer != NULL) {
@@ -82,184 +96,744 @@ static void scene_node_get_size(wlr_scene_node* node, int* width, int* height)
     }
 }
 
-static void render_window_borders(wlr_render_pass* pass, wlr_box window_box, float const color[4], int width)
+/*
+ * Everything drawn goes through these, so that it can be recorded instead when
+ * the frame is composited by other means (see TileCompositor)
+ */
+static void pass_add_rect(Renderer::NodeRenderOptions* options,
+                          wlr_render_rect_options const* rect_options)
 {
-    wlr_render_rect_options rect_options = {
-        .color = {
-            .r = color[0],
-            .g = color[1],
-            .b = color[2],
-            .a = color[3],
-        },
-    };
+    if (options->recording == nullptr) {
+        wlr_render_pass_add_rect(options->render_pass, rect_options);
+        return;
+    }
 
-    rect_options.box = {
-        .x = window_box.x - width,
-        .y = window_box.y - width,
-        .width = window_box.width + width * 2,
-        .height = width,
-    };
-    wlr_render_pass_add_rect(pass, &rect_options);
+    Renderer::RecordedOp op = {};
+    op.is_texture = false;
+    op.rect = *rect_options;
+    op.has_clip = rect_options->clip != nullptr;
+    pixman_region32_init(&op.clip);
+    if (op.has_clip) {
+        pixman_region32_copy(&op.clip, rect_options->clip);
+    }
+    options->recording->push_back(op);
+}
 
-    rect_options.box = {
-        .x = window_box.x - width,
-        .y = window_box.y + window_box.height,
-        .width = window_box.width + width * 2,
-        .height = width,
-    };
-    wlr_render_pass_add_rect(pass, &rect_options);
+static void pass_add_texture(Renderer::NodeRenderOptions* options,
+                             wlr_render_texture_options const* texture_options,
+                             wlr_scene_buffer const* scene_buffer)
+{
+    if (options->recording == nullptr) {
+        wlr_render_pass_add_texture(options->render_pass, texture_options);
+        return;
+    }
 
-    rect_options.box = {
-        .x = window_box.x - width,
-        .y = window_box.y,
-        .width = width,
-        .height = window_box.height,
-    };
-    wlr_render_pass_add_rect(pass, &rect_options);
+    Renderer::RecordedOp op = {};
+    op.is_texture = true;
+    op.texture = *texture_options;
+    op.alpha = texture_options->alpha ? *texture_options->alpha : 1.0f;
+    op.has_clip = texture_options->clip != nullptr;
+    pixman_region32_init(&op.clip);
+    if (op.has_clip) {
+        pixman_region32_copy(&op.clip, texture_options->clip);
+    }
 
-    rect_options.box = {
-        .x = window_box.x + window_box.width,
-        .y = window_box.y,
-        .width = width,
-        .height = window_box.height,
-    };
-    wlr_render_pass_add_rect(pass, &rect_options);
+    /* The buffer whose pixels the texture shows, if it has any to read */
+    if (scene_buffer != nullptr && scene_buffer->buffer != nullptr) {
+        wlr_client_buffer const* client_buffer
+            = wlr_client_buffer_get(scene_buffer->buffer);
+        op.source = client_buffer ? client_buffer->source
+                                  : scene_buffer->buffer;
+    }
+    options->recording->push_back(op);
+}
+
+void Renderer::replay_recording(wlr_render_pass* pass,
+                                std::vector<RecordedOp>& ops)
+{
+    for (auto& op : ops) {
+        if (op.is_texture) {
+            op.texture.alpha = &op.alpha;
+            op.texture.clip = op.has_clip ? &op.clip : nullptr;
+            wlr_render_pass_add_texture(pass, &op.texture);
+        } else {
+            op.rect.clip = op.has_clip ? &op.clip : nullptr;
+            wlr_render_pass_add_rect(pass, &op.rect);
+        }
+    }
+}
+
+void Renderer::clear_recording(std::vector<RecordedOp>& ops)
+{
+    for (auto& op : ops) {
+        pixman_region32_fini(&op.clip);
+    }
+    ops.clear();
+}
+
+/*
+ * Solid fills (rect nodes, single-pixel buffers, borders and the background)
+ * are accumulated here and submitted as a single rect operation for as long
+ * as nothing else has to be drawn in between.
+ */
+struct FillBatch {
+    Renderer::NodeRenderOptions* options;
+    wlr_render_color color = {};
+    pixman_region32_t region;
+    bool active = false;
+};
+
+static bool render_color_equal(wlr_render_color const& a,
+                               wlr_render_color const& b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static void flush_fills(FillBatch& batch)
+{
+    if (!batch.active) {
+        return;
+    }
+
+    if (pixman_region32_not_empty(&batch.region)) {
+        pixman_box32_t const* extents = pixman_region32_extents(&batch.region);
+        wlr_render_rect_options rect_options = {
+            .box = {
+                .x = extents->x1,
+                .y = extents->y1,
+                .width = extents->x2 - extents->x1,
+                .height = extents->y2 - extents->y1,
+            },
+            .color = batch.color,
+            .clip = &batch.region,
+        };
+        pass_add_rect(batch.options, &rect_options);
+    }
+
+    pixman_region32_fini(&batch.region);
+    batch.active = false;
+}
+
+static void add_fill(FillBatch& batch, wlr_render_color const& color,
+                     pixman_region32_t const* region)
+{
+    if (!pixman_region32_not_empty(region)) {
+        return;
+    }
+
+    /* Merging translucent fills would blend overlapping parts only once */
+    if (batch.active && color.a == 1.0f
+        && render_color_equal(batch.color, color)) {
+        pixman_region32_union(&batch.region, &batch.region, region);
+        return;
+    }
+
+    flush_fills(batch);
+    batch.color = color;
+    pixman_region32_init(&batch.region);
+    pixman_region32_copy(&batch.region, region);
+    batch.active = true;
+}
+
+/* Single-pixel buffers (and any other 1x1 client buffer we can read) are just
+ * a color, no need to go through a texture for them */
+static bool scene_buffer_get_solid_color(wlr_scene_buffer* scene_buffer,
+                                         wlr_render_color* color)
+{
+    wlr_buffer* buffer = scene_buffer->buffer;
+    if (buffer == nullptr || buffer->width != 1 || buffer->height != 1) {
+        return false;
+    }
+
+    wlr_client_buffer const* client_buffer = wlr_client_buffer_get(buffer);
+    if (client_buffer != nullptr) {
+        buffer = client_buffer->source;
+    }
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    void* data;
+    uint32_t format;
+    size_t stride;
+    if (!wlr_buffer_begin_data_ptr_access(
+            buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+        return false;
+    }
+
+    bool const has_alpha = format == DRM_FORMAT_ARGB8888;
+    bool const supported = has_alpha || format == DRM_FORMAT_XRGB8888;
+    if (supported) {
+        uint32_t pixel;
+        std::memcpy(&pixel, data, sizeof(pixel));
+        /* Pixel data is premultiplied, just like render pass colors */
+        *color = {
+            .r = static_cast<float>((pixel >> 16) & 0xFF) / 255,
+            .g = static_cast<float>((pixel >> 8) & 0xFF) / 255,
+            .b = static_cast<float>(pixel & 0xFF) / 255,
+            .a = has_alpha ? static_cast<float>((pixel >> 24) & 0xFF) / 255
+                           : 1.0f,
+        };
+    }
+    wlr_buffer_end_data_ptr_access(buffer);
+
+    return supported;
 }
 
-void Renderer::render_buffer_node(wlr_scene_node* node, NodeRenderOptions* options)
+/*
+ * Per surface type parts of a draw list item. The surface type is stored on
+ * the surface itself, so resolving it needs neither RTTI nor virtual calls.
+ */
+template <SurfaceType Type> static void fill_surface_item(Renderer::DrawItem&);
+
+template <>
+void fill_surface_item<NAOLAND_SURFACE_TYPE_VIEW>(Renderer::DrawItem& item)
+{
+    View* view = static_cast<View*>(item.surface);
+    item.view = view;
+    item.animation = &view->animation;
+
+    if (!view->is_x11()) {
+        wlr_box geom = view->get_geometry();
+        item.border_box = {
+            .x = item.box.x + geom.x,
+            .y = item.box.y + geom.y,
+            .width = geom.width,
+            .height = geom.height,
+        };
+    }
+}
+
+template <>
+void fill_surface_item<NAOLAND_SURFACE_TYPE_POPUP>(Renderer::DrawItem& item)
+{
+    item.animation = &static_cast<Popup*>(item.surface)->animation;
+}
+
+template <>
+void fill_surface_item<NAOLAND_SURFACE_TYPE_LAYER>(Renderer::DrawItem&)
+{
+    /* Layer surfaces are neither animated nor decorated */
+}
+
+static void build_buffer_item(wlr_scene_node* node,
+                              Renderer::NodeRenderOptions* options,
+                              std::vector<Renderer::DrawItem>& items)
 {
     assert(node->type == WLR_SCENE_NODE_BUFFER && "Node is not of type buffer");
 
+    Renderer::DrawItem item = {};
+    item.scene_buffer = wlr_scene_buffer_from_node(node);
+
     /*
-     * Get destination box (window region on screen)
+     * Get destination box (window region in the layout)
      */
-    wlr_box dst_box = {};
-    wlr_scene_node_coords(node, &dst_box.x, &dst_box.y);
-    dst_box.x -= options->scene_output->x;
-    dst_box.y -= options->scene_output->y;
-    scene_node_get_size(node, &dst_box.width, &dst_box.height);
+    wlr_scene_node_coords(node, &item.box.x, &item.box.y);
+    scene_node_get_size(node, &item.box.width, &item.box.height);
 
     /*
-     * Get some texture parameters
+     * Skip buffers on other outputs. Borders may stick out of the buffer, so
+     * they are accounted for even though we don't know yet if this is a view.
      */
-    wlr_scene_buffer* scene_buffer = wlr_scene_buffer_from_node(node);
-    wlr_texture* texture
-        = scene_buffer_get_texture(scene_buffer, options->server.renderer);
-
-    wl_output_transform transform = wlr_output_transform_invert(scene_buffer->transform);
-    transform = wlr_output_transform_compose(transform, options->transform);
+    int const border_width = options->server.config.border.width;
+    wlr_box const cull_box = {
+        .x = item.box.x - border_width,
+        .y = item.box.y - border_width,
+        .width = item.box.width + border_width * 2,
+        .height = item.box.height + border_width * 2,
+    };
+    wlr_box intersection;
+    if (!wlr_box_intersection(&intersection, &cull_box,
+                              &options->output_box)) {
+        return;
+    }
 
     /*
      * Get associated surface
      */
-    Surface* surface = nullptr;
-    bool is_view = false;
-    Animation* animation = nullptr;
-    {
-        wlr_surface* wlr_surface = wlr_scene_surface_try_from_buffer(scene_buffer)->surface;
-        if (wlr_surface)
-            surface = static_cast<Surface*>(wlr_surface->data);
-
-        if (surface) {
-            if (surface->is_popup()) {
-                animation = &dynamic_cast<Popup*>(surface)->animation;
-            } else if (surface->is_view()) {
-                is_view = true;
-                animation = &dynamic_cast<View*>(surface)->animation;
+    wlr_scene_surface* scene_surface
+        = wlr_scene_surface_try_from_buffer(item.scene_buffer);
+    if (scene_surface && scene_surface->surface) {
+        item.surface = static_cast<Surface*>(scene_surface->surface->data);
+    }
+
+    item.border_box = item.box;
+    if (item.surface) {
+        switch (item.surface->type) {
+        case NAOLAND_SURFACE_TYPE_VIEW:
+            fill_surface_item<NAOLAND_SURFACE_TYPE_VIEW>(item);
+            break;
+        case NAOLAND_SURFACE_TYPE_LAYER:
+            fill_surface_item<NAOLAND_SURFACE_TYPE_LAYER>(item);
+            break;
+        case NAOLAND_SURFACE_TYPE_POPUP:
+            fill_surface_item<NAOLAND_SURFACE_TYPE_POPUP>(item);
+            break;
+        }
+    }
+
+    items.push_back(item);
+}
+
+static void build_rect_item(wlr_scene_node* node,
+                            Renderer::NodeRenderOptions* options,
+                            std::vector<Renderer::DrawItem>& items)
+{
+    wlr_scene_rect const* scene_rect = wlr_scene_rect_from_node(node);
+
+    Renderer::DrawItem item = {};
+    wlr_scene_node_coords(node, &item.box.x, &item.box.y);
+    item.box.width = scene_rect->width;
+    item.box.height = scene_rect->height;
+
+    wlr_box intersection;
+    if (!wlr_box_intersection(&intersection, &item.box,
+                              &options->output_box)) {
+        return;
+    }
+
+    item.solid = true;
+    item.color = {
+        .r = scene_rect->color[0],
+        .g = scene_rect->color[1],
+        .b = scene_rect->color[2],
+        .a = scene_rect->color[3],
+    };
+    item.border_box = item.box;
+
+    items.push_back(item);
+}
+
+/* Views with an animation snapshot are drawn from it as a single item, in
+ * place of their whole subtree */
+static bool build_snapshot_item(Surface* surface,
+                                std::vector<Renderer::DrawItem>& items)
+{
+    if (surface->type != NAOLAND_SURFACE_TYPE_VIEW) {
+        return false;
+    }
+
+    Animation& animation = static_cast<View*>(surface)->animation;
+    if (animation.get_snapshot() == nullptr) {
+        return false;
+    }
+
+    Renderer::DrawItem item = {};
+    item.texture = animation.get_snapshot();
+    item.surface = surface;
+    item.animation = &animation;
+    item.box = animation.get_snapshot_box();
+    item.border_box = item.box;
+
+    items.push_back(item);
+    return true;
+}
+
+static void build_draw_list(wlr_scene_node* node,
+                            Renderer::NodeRenderOptions* options,
+                            std::vector<Renderer::DrawItem>& items)
+{
+    if (!node->enabled)
+        return;
+
+    switch (node->type) {
+    case WLR_SCENE_NODE_RECT:
+        build_rect_item(node, options, items);
+        break;
+    case WLR_SCENE_NODE_TREE: {
+        /* Surface trees remember their bounds, so whole windows sitting on
+         * another output are rejected without walking them */
+        if (node->data != nullptr) {
+            auto* surface = static_cast<Surface*>(node->data);
+            wlr_box const bounds = surface->get_cached_bounds();
+            wlr_box intersection;
+            if (!wlr_box_intersection(&intersection, &bounds,
+                                      &options->output_box)) {
+                return;
+            }
+
+            if (build_snapshot_item(surface, items)) {
+                return;
             }
         }
+
+        wlr_scene_tree* tree = wlr_scene_tree_from_node(node);
+        /* Workspaces shown on other outputs are enabled too, only this
+         * output's one is drawn here. Snapshots have no output and are never
+         * taken of a whole layer. */
+        Output const* output = nullptr;
+        bool const workspaces = options->scene_output != nullptr
+            && tree == options->server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL];
+        if (workspaces) {
+            output = static_cast<Output*>(options->scene_output->output->data);
+        }
+        wlr_scene_node* n = {};
+        wl_list_for_each(n, &tree->children, link)
+        {
+            if (workspaces && n->type == WLR_SCENE_NODE_TREE
+                && n->data == nullptr
+                && (output == nullptr || output->active_workspace == nullptr
+                    || n != &output->active_workspace->scene_tree->node)) {
+                continue;
+            }
+            build_draw_list(n, options, items);
+        }
+    } break;
+    case WLR_SCENE_NODE_BUFFER:
+        build_buffer_item(node, options, items);
+        break;
+    }
+}
+
+/* Turns a draw list item into what is going to be drawn this frame, in
+ * coordinates local to the output box and with the current animation step
+ * applied */
+static Renderer::RenderEntry make_entry(Renderer::DrawItem const& item,
+                                        Renderer::NodeRenderOptions* options)
+{
+    Renderer::RenderEntry entry = {};
+    entry.item = &item;
+    entry.solid = item.solid;
+    entry.color = item.color;
+    entry.texture = item.texture;
+
+    /* Clients attach new buffers without the scene moving, so the buffer is
+     * only looked at now */
+    if (item.scene_buffer != nullptr) {
+        entry.solid
+            = scene_buffer_get_solid_color(item.scene_buffer, &entry.color);
+        if (!entry.solid) {
+            entry.texture = scene_buffer_get_texture(item.scene_buffer,
+                                                     options->server.renderer);
+        }
     }
 
+    wlr_box dst_box = item.box;
+    dst_box.x -= options->output_box.x;
+    dst_box.y -= options->output_box.y;
+
+    wlr_box border_box = item.border_box;
+    border_box.x -= options->output_box.x;
+    border_box.y -= options->output_box.y;
+
     /*
      * Apply animation factor
      */
-    bool animating = animation ? animation->is_animating() : false;
+    Animation* animation = item.animation;
+    entry.animating = animation ? animation->is_animating() : false;
+    entry.alpha = 1.0f;
+
+    /* Boxes follow the configured easing, opacity fades linearly along the
+     * same timeline */
+    if (entry.animating) {
+        double const scale = animation->get_factor();
+        float const fade = static_cast<float>(
+            animation->get_factor(ANIMATION_EASING_LINEAR));
+        float const opacity = item.scene_buffer ? item.scene_buffer->opacity
+                                                : 1.0f;
 
-    wlr_box border_box = dst_box;
-    if (is_view) {
-        View* view = dynamic_cast<View*>(surface);
-        wlr_box geom = view->get_geometry();
-        border_box = view->is_x11() ? dst_box
-                                    : wlr_box {
-                                          .x = dst_box.x + geom.x,
-                                          .y = dst_box.y + geom.y,
-                                          .width = geom.width,
-                                          .height = geom.height,
-                                      };
-    }
-
-    float alpha = 1.0f;
-
-    if (animating)
         switch (animation->get_role()) {
         case ANIMATION_ZOOM:
-            dst_box = scale_box(dst_box, animation->get_factor());
-            border_box = scale_box(border_box, animation->get_factor());
-            alpha = scene_buffer->opacity * (animating ? animation->get_factor() : 1);
+            dst_box = scale_box(dst_box, scale);
+            border_box = scale_box(border_box, scale);
+            entry.alpha = opacity * fade;
             break;
         case ANIMATION_ZOOM_FROM_BOTTOM:
-            dst_box = scale_box(dst_box, animation->get_factor(), true);
-            border_box = scale_box(border_box, animation->get_factor(), true);
-            alpha = scene_buffer->opacity * (animating ? animation->get_factor() : 1);
+            dst_box = scale_box(dst_box, scale, true);
+            border_box = scale_box(border_box, scale, true);
+            entry.alpha = opacity * fade;
             break;
         case ANIMATION_FADE:
-            alpha = scene_buffer->opacity * (animating ? animation->get_factor() : 1);
+            entry.alpha = opacity * fade;
             break;
         }
+    }
+
+    entry.dst_box = dst_box;
+    entry.border_box = border_box;
+    return entry;
+}
+
+/*
+ * Walks the entries front to back and computes which part of each one is
+ * actually visible within the damage, given everything opaque on top of it.
+ * Returns the area that ends up covered by opaque content in `occluded`.
+ */
+static void compute_visibility(std::vector<Renderer::RenderEntry>& entries,
+                               Renderer::NodeRenderOptions* options,
+                               pixman_region32_t* occluded)
+{
+    Config const& config = options->server.config;
+    int const border_width = config.border.width;
+
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        Renderer::RenderEntry& entry = *it;
+        wlr_box const& dst_box = entry.dst_box;
+        wlr_box const& border_box = entry.border_box;
+
+        pixman_region32_init_rect(&entry.visible, dst_box.x, dst_box.y,
+                                  dst_box.width, dst_box.height);
+        pixman_region32_intersect(&entry.visible, &entry.visible,
+                                  options->damage);
+        pixman_region32_subtract(&entry.visible, &entry.visible, occluded);
+
+        pixman_region32_init(&entry.border_visible);
+        if (entry.item->view && border_width > 0) {
+            pixman_region32_union_rect(
+                &entry.border_visible, &entry.border_visible,
+                border_box.x - border_width, border_box.y - border_width,
+                border_box.width + border_width * 2,
+                border_box.height + border_width * 2);
+            pixman_region32_t inner;
+            pixman_region32_init_rect(&inner, border_box.x, border_box.y,
+                                      border_box.width, border_box.height);
+            pixman_region32_subtract(&entry.border_visible,
+                                     &entry.border_visible, &inner);
+            pixman_region32_fini(&inner);
+
+            pixman_region32_intersect(&entry.border_visible,
+                                      &entry.border_visible, options->damage);
+            pixman_region32_subtract(&entry.border_visible,
+                                     &entry.border_visible, occluded);
+        }
+
+        /* Translucent or animated content never hides what is below */
+        if (entry.animating || entry.alpha < 1.0f) {
+            continue;
+        }
+
+        pixman_region32_t opaque;
+        pixman_region32_init(&opaque);
+        if (entry.solid) {
+            if (entry.color.a == 1.0f) {
+                pixman_region32_union_rect(&opaque, &opaque, 0, 0,
+                                           dst_box.width, dst_box.height);
+            }
+        } else if (entry.texture != nullptr
+                   && entry.item->scene_buffer != nullptr) {
+            /* A buffer without a texture is not drawn, so it hides nothing
+             * and the background has to be cleared under it */
+            pixman_region32_copy(&opaque,
+                                 &entry.item->scene_buffer->opaque_region);
+        }
+        pixman_region32_translate(&opaque, dst_box.x, dst_box.y);
+        pixman_region32_intersect_rect(&opaque, &opaque, dst_box.x, dst_box.y,
+                                       dst_box.width, dst_box.height);
+        pixman_region32_union(occluded, occluded, &opaque);
+        pixman_region32_fini(&opaque);
+
+        View const* view = entry.item->view;
+        uint32_t const border_color = view && view->is_active
+            ? config.border.color.focused
+            : config.border.color.unfocused;
+        if (view && (border_color & 0xFF) == 0xFF) {
+            pixman_region32_union(occluded, occluded, &entry.border_visible);
+        }
+    }
+}
+
+static void render_entry(Renderer::RenderEntry& entry,
+                         Renderer::NodeRenderOptions* options,
+                         FillBatch& fills)
+{
+    Renderer::DrawItem const& item = *entry.item;
+
+    /*
+     * Render solid color
+     */
+    if (entry.solid) {
+        wlr_render_color color = entry.color;
+        if (item.scene_buffer != nullptr) {
+            float const alpha = entry.animating
+                ? entry.alpha
+                : entry.alpha * item.scene_buffer->opacity;
+            color = { color.r * alpha, color.g * alpha, color.b * alpha,
+                      color.a * alpha };
+        }
+        add_fill(fills, color, &entry.visible);
+    }
 
     /*
      * Render texture
      */
-    wlr_render_texture_options render_options = {
-        .texture = texture,
-        .src_box = scene_buffer->src_box,
-        .dst_box = dst_box,
-        .alpha = &alpha,
-        .transform = transform,
-        .filter_mode = scene_buffer->filter_mode,
-    };
-    wlr_render_pass_add_texture(options->render_pass, &render_options);
+    if (!entry.solid && entry.texture != nullptr
+        && pixman_region32_not_empty(&entry.visible)) {
+        wlr_render_texture_options render_options = {
+            .texture = entry.texture,
+            .dst_box = entry.dst_box,
+            .alpha = &entry.alpha,
+            .clip = &entry.visible,
+            .transform = options->transform,
+            .filter_mode = WLR_SCALE_FILTER_BILINEAR,
+        };
+
+        /* Snapshots have no scene buffer, they are drawn as they are */
+        wlr_scene_buffer const* scene_buffer = item.scene_buffer;
+        if (scene_buffer != nullptr) {
+            render_options.src_box = scene_buffer->src_box;
+            render_options.transform = wlr_output_transform_compose(
+                wlr_output_transform_invert(scene_buffer->transform),
+                options->transform);
+            render_options.filter_mode = scene_buffer->filter_mode;
+        }
+        flush_fills(fills);
+        pass_add_texture(options, &render_options, item.scene_buffer);
+    }
 
     /*
      * Render window borders
      */
-    if (is_view) {
-        View* view = dynamic_cast<View*>(surface);
-
+    if (item.view && pixman_region32_not_empty(&entry.border_visible)) {
         float color[4];
-        int_to_float_array(view->is_active
+        int_to_float_array(item.view->is_active
                            ? options->server.config.border.color.focused
                            : options->server.config.border.color.unfocused, color);
-        render_window_borders(options->render_pass, border_box, color,
-                              options->server.config.border.width);
+        add_fill(fills, { color[0], color[1], color[2], color[3] },
+                 &entry.border_visible);
     }
+}
 
+/* Brings `options->draw_list` up to date with the scene. Only the server,
+ * scene output and output box of `options` are used. */
+void Renderer::update_draw_list(wlr_scene_node* node,
+                                NodeRenderOptions* options)
+{
     /*
-     * Update animation
+     * The draw list only changes with the scene, see Server::scene_generation
      */
-    if (animation)
-        animation->update();
+    DrawList& draw_list = *options->draw_list;
+    if (draw_list.generation != options->server.scene_generation) {
+        draw_list.items.clear();
+        build_draw_list(node, options, draw_list.items);
+        draw_list.generation = options->server.scene_generation;
+    }
 }
 
 void Renderer::render_scene_node(wlr_scene_node* node, NodeRenderOptions* options)
 {
-    if (!node->enabled)
-        return;
+    update_draw_list(node, options);
+    DrawList const& draw_list = *options->draw_list;
 
-    switch (node->type) {
-    case WLR_SCENE_NODE_RECT:
-        wlr_log(WLR_ERROR, "Rendering rectangles is not implemented yet\n");
-        break;
-    case WLR_SCENE_NODE_TREE: {
-        wlr_scene_tree* tree = wlr_scene_tree_from_node(node);
-        wlr_scene_node* n = {};
-        wl_list_for_each(n, &tree->children, link)
-        {
-            render_scene_node(n, options);
+    std::vector<RenderEntry> entries;
+    entries.reserve(draw_list.items.size());
+    for (auto const& item : std::as_const(draw_list.items)) {
+        entries.push_back(make_entry(item, options));
+    }
+
+    pixman_region32_t occluded;
+    pixman_region32_init(&occluded);
+    compute_visibility(entries, options, &occluded);
+
+    /*
+     * Clear whatever part of the damage no opaque content covers
+     */
+    FillBatch fills = { .options = options };
+
+    pixman_region32_t background;
+    pixman_region32_init(&background);
+    pixman_region32_subtract(&background, options->damage, &occluded);
+    add_fill(fills, options->clear_color, &background);
+    pixman_region32_fini(&background);
+    pixman_region32_fini(&occluded);
+
+    for (auto& entry : entries) {
+        render_entry(entry, options, fills);
+
+        /* Lets the scene send presentation feedback for the surface, just
+         * like it does for the buffers it renders itself. Entries hidden
+         * entirely by what is on top of them were not shown. */
+        if (entry.item->scene_buffer != nullptr
+            && pixman_region32_not_empty(&entry.visible)) {
+            wl_signal_emit_mutable(
+                &entry.item->scene_buffer->events.output_present,
+                options->scene_output);
         }
-    } break;
-    case WLR_SCENE_NODE_BUFFER:
-        render_buffer_node(node, options);
-        break;
+        pixman_region32_fini(&entry.visible);
+        pixman_region32_fini(&entry.border_visible);
+    }
+    flush_fills(fills);
+}
+
+/*
+ * Renders a scene tree, borders included, into a texture covering `box`
+ * (in layout coordinates). Used by animations to draw a window as a single
+ * quad, whatever the client does with its buffers in the meantime.
+ */
+wlr_texture* Renderer::render_snapshot(Server& server, wlr_scene_tree* tree,
+                                       wlr_box const& box)
+{
+    uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+    wlr_drm_format format = {
+        .format = DRM_FORMAT_ARGB8888,
+        .len = 1,
+        .capacity = 1,
+        .modifiers = &modifier,
+    };
+    wlr_buffer* buffer = wlr_allocator_create_buffer(
+        server.allocator, box.width, box.height, &format);
+    if (buffer == nullptr) {
+        wlr_log(WLR_ERROR, "Failed to allocate an animation snapshot");
+        return nullptr;
+    }
+
+    wlr_render_pass* pass
+        = wlr_renderer_begin_buffer_pass(server.renderer, buffer, nullptr);
+    if (pass == nullptr) {
+        wlr_buffer_drop(buffer);
+        return nullptr;
+    }
+
+    wlr_render_rect_options clear_options = {
+        .box = { .width = box.width, .height = box.height },
+        .color = { 0, 0, 0, 0 },
+        .blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+    };
+    wlr_render_pass_add_rect(pass, &clear_options);
+
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, 0, 0, box.width, box.height);
+
+    NodeRenderOptions options = {
+        .server = server,
+        .render_pass = pass,
+        .scene_output = nullptr,
+        .transform = WL_OUTPUT_TRANSFORM_NORMAL,
+        .output_box = box,
+        .damage = &damage,
+        .clear_color = {},
+        .draw_list = nullptr,
+    };
+
+    /* The snapshot is taken at rest, the animation is applied to it later */
+    std::vector<DrawItem> items;
+    build_draw_list(&tree->node, &options, items);
+    std::vector<RenderEntry> entries;
+    entries.reserve(items.size());
+    for (auto& item : items) {
+        item.animation = nullptr;
+        entries.push_back(make_entry(item, &options));
     }
+
+    pixman_region32_t occluded;
+    pixman_region32_init(&occluded);
+    compute_visibility(entries, &options, &occluded);
+    pixman_region32_fini(&occluded);
+
+    FillBatch fills = { .options = &options };
+    for (auto& entry : entries) {
+        render_entry(entry, &options, fills);
+        pixman_region32_fini(&entry.visible);
+        pixman_region32_fini(&entry.border_visible);
+    }
+    flush_fills(fills);
+    pixman_region32_fini(&damage);
+
+    wlr_texture* texture = nullptr;
+    if (wlr_render_pass_submit(pass)) {
+        /* The texture keeps its own reference to the buffer */
+        texture = wlr_texture_from_buffer(server.renderer, buffer);
+    }
+    wlr_buffer_drop(buffer);
+
+    return texture;
 }
@@ -3,6 +3,9 @@
 
 #include "server.hpp"
 
+#include <cstdint>
+#include <vector>
+
 #include "wlr-wrap-start.hpp"
 #include <wayland-server-protocol.h>
 #include "wlr/render/wlr_renderer.h"
@@ -10,15 +13,84 @@
 
 namespace Renderer {
 
+/* A scene buffer, rect or animation snapshot that is part of an output's
+ * draw list. Everything in here only changes along with the placement and
+ * stacking of the scene graph, buffer contents are looked up when drawing. */
+struct DrawItem {
+    wlr_scene_buffer* scene_buffer;
+    /* Animation snapshot, scene buffers resolve theirs in RenderEntry */
+    wlr_texture* texture;
+    Surface* surface;
+    View* view;
+    Animation* animation;
+    /* Set for rect nodes, which are drawn as a premultiplied solid color */
+    bool solid;
+    wlr_render_color color;
+    /* Layout-space boxes of the buffer and of the area framed by borders */
+    wlr_box box;
+    wlr_box border_box;
+};
+
+/* Scene nodes visible on an output, back to front. Rebuilt whenever the
+ * server's scene_generation moves past `generation`. */
+struct DrawList {
+    std::vector<DrawItem> items;
+    uint64_t generation = 0;
+};
+
+/* A render pass operation kept for later. Clip, and alpha for textures, are
+ * owned by the operation, the pointers to them are only set on replay. */
+struct RecordedOp {
+    bool is_texture;
+    wlr_render_rect_options rect;
+    wlr_render_texture_options texture;
+    float alpha;
+    bool has_clip;
+    pixman_region32_t clip;
+    /* Buffer holding the texture's pixels, when there is one */
+    wlr_buffer* source;
+};
+
 struct NodeRenderOptions {
     Server& server;
     wlr_render_pass* render_pass;
     wlr_scene_output* scene_output;
     wl_output_transform transform;
+    /* Layout-space area of the output, anything outside of it is skipped */
+    wlr_box output_box;
+    pixman_region32_t const* damage;
+    wlr_render_color clear_color;
+    DrawList* draw_list;
+    /* When set, operations are appended here instead of being added to the
+     * render pass */
+    std::vector<RecordedOp>* recording = nullptr;
+};
+
+/* A draw list item as it is going to be drawn this frame */
+struct RenderEntry {
+    DrawItem const* item;
+    /* What the item shows this frame: single-pixel buffers are drawn as a
+     * solid color too */
+    bool solid;
+    wlr_render_color color;
+    wlr_texture* texture;
+    bool animating;
+    float alpha;
+    /* Output-local boxes, with the animation applied */
+    wlr_box dst_box;
+    wlr_box border_box;
+    /* Parts of the buffer and its borders not hidden by opaque content on
+     * top, clipped to the damage */
+    pixman_region32_t visible;
+    pixman_region32_t border_visible;
 };
 
+void update_draw_list(wlr_scene_node* node, NodeRenderOptions* options);
 void render_scene_node(wlr_scene_node* node, NodeRenderOptions* options);
-void render_buffer_node(wlr_scene_node* node, NodeRenderOptions* options);
+wlr_texture* render_snapshot(Server& server, wlr_scene_tree* tree,
+                             wlr_box const& box);
+void replay_recording(wlr_render_pass* pass, std::vector<RecordedOp>& ops);
+void clear_recording(std::vector<RecordedOp>& ops);
 
 }
 
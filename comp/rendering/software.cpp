@@ -0,0 +1,326 @@
+#include "software.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "wlr-wrap-start.hpp"
+#include <drm_fourcc.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/box.h>
+#include "wlr-wrap-end.hpp"
+
+#define TILE_SIZE 128
+
+static bool get_pixman_format(uint32_t drm_format, pixman_format_code_t* format)
+{
+    switch (drm_format) {
+    case DRM_FORMAT_ARGB8888:
+        *format = PIXMAN_a8r8g8b8;
+        return true;
+    case DRM_FORMAT_XRGB8888:
+        *format = PIXMAN_x8r8g8b8;
+        return true;
+    case DRM_FORMAT_ABGR8888:
+        *format = PIXMAN_a8b8g8r8;
+        return true;
+    case DRM_FORMAT_XBGR8888:
+        *format = PIXMAN_x8b8g8r8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Textures the pixman render pass would draw without any transform or
+ * scaling, anything else is left to the render pass itself */
+static bool texture_op_is_plain(Renderer::RecordedOp const& op)
+{
+    wlr_render_texture_options const& options = op.texture;
+    if (options.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        return false;
+    }
+
+    wlr_fbox const& src_box = options.src_box;
+    int width = static_cast<int>(options.texture->width);
+    int height = static_cast<int>(options.texture->height);
+    if (!wlr_fbox_empty(&src_box)) {
+        if (src_box.x != std::round(src_box.x)
+            || src_box.y != std::round(src_box.y)
+            || src_box.width != std::round(src_box.width)
+            || src_box.height != std::round(src_box.height)) {
+            return false;
+        }
+        width = static_cast<int>(src_box.width);
+        height = static_cast<int>(src_box.height);
+    }
+
+    return width == options.dst_box.width && height == options.dst_box.height;
+}
+
+Renderer::TileCompositor::TileCompositor(int thread_count)
+{
+    /* The main thread takes its share of the tiles too */
+    for (int i = 1; i < thread_count; i++) {
+        workers.emplace_back(&TileCompositor::worker_main, this);
+    }
+}
+
+Renderer::TileCompositor::~TileCompositor()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+/* Checks that every operation can be composited here and gets hold of the
+ * pixels of every texture. Must be followed by end(), whatever it returns. */
+bool Renderer::TileCompositor::begin(std::vector<RecordedOp> const& recorded)
+{
+    ops = &recorded;
+    sources.assign(recorded.size(), Source {});
+
+    for (size_t i = 0; i < recorded.size(); i++) {
+        RecordedOp const& op = recorded[i];
+        if (!op.is_texture) {
+            continue;
+        }
+
+        if (op.source == nullptr || !texture_op_is_plain(op)) {
+            return false;
+        }
+
+        /* A buffer can only be accessed once at a time */
+        Source* shared = nullptr;
+        for (size_t j = 0; j < i; j++) {
+            if (sources[j].buffer == op.source) {
+                shared = &sources[j];
+                break;
+            }
+        }
+        if (shared != nullptr) {
+            sources[i] = *shared;
+            sources[i].buffer = nullptr;
+            continue;
+        }
+
+        void* data;
+        uint32_t drm_format;
+        size_t stride;
+        if (!wlr_buffer_begin_data_ptr_access(op.source,
+                                              WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                              &data, &drm_format, &stride)) {
+            return false;
+        }
+
+        Source& source = sources[i];
+        source = {
+            .buffer = op.source,
+            .data = data,
+            .width = op.source->width,
+            .height = op.source->height,
+            .stride = static_cast<int>(stride),
+        };
+        if (!get_pixman_format(drm_format, &source.format)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Renderer::TileCompositor::end()
+{
+    for (auto const& source : std::as_const(sources)) {
+        if (source.buffer != nullptr) {
+            wlr_buffer_end_data_ptr_access(source.buffer);
+        }
+    }
+    sources.clear();
+    ops = nullptr;
+}
+
+/* Composites the operations passed to begin() over the damaged part of
+ * `target`, which no render pass may be accessing at the same time */
+bool Renderer::TileCompositor::composite(wlr_buffer* target,
+                                         pixman_region32_t const* damage)
+{
+    void* data;
+    uint32_t drm_format;
+    size_t stride;
+    if (!wlr_buffer_begin_data_ptr_access(target,
+                                          WLR_BUFFER_DATA_PTR_ACCESS_WRITE,
+                                          &data, &drm_format, &stride)) {
+        return false;
+    }
+
+    if (!get_pixman_format(drm_format, &target_format)) {
+        wlr_buffer_end_data_ptr_access(target);
+        return false;
+    }
+    target_data = data;
+    target_width = target->width;
+    target_height = target->height;
+    target_stride = static_cast<int>(stride);
+
+    tiles.clear();
+    for (int y = 0; y < target_height; y += TILE_SIZE) {
+        for (int x = 0; x < target_width; x += TILE_SIZE) {
+            pixman_box32_t tile = {
+                .x1 = x,
+                .y1 = y,
+                .x2 = std::min(x + TILE_SIZE, target_width),
+                .y2 = std::min(y + TILE_SIZE, target_height),
+            };
+            if (pixman_region32_contains_rectangle(damage, &tile)
+                != PIXMAN_REGION_OUT) {
+                tiles.push_back(tile);
+            }
+        }
+    }
+    next_tile = 0;
+
+    {
+        std::lock_guard lock(mutex);
+        job++;
+        pending_workers = static_cast<int>(workers.size());
+    }
+    work_available.notify_all();
+
+    run_tiles();
+
+    {
+        std::unique_lock lock(mutex);
+        work_done.wait(lock, [this] { return pending_workers == 0; });
+    }
+
+    wlr_buffer_end_data_ptr_access(target);
+    target_data = nullptr;
+    return true;
+}
+
+void Renderer::TileCompositor::worker_main()
+{
+    uint64_t last_job = 0;
+
+    for (;;) {
+        {
+            std::unique_lock lock(mutex);
+            work_available.wait(
+                lock, [&] { return stopping || job != last_job; });
+            if (stopping) {
+                return;
+            }
+            last_job = job;
+        }
+
+        run_tiles();
+
+        {
+            std::lock_guard lock(mutex);
+            pending_workers--;
+        }
+        work_done.notify_one();
+    }
+}
+
+void Renderer::TileCompositor::run_tiles()
+{
+    for (;;) {
+        size_t const index = next_tile.fetch_add(1);
+        if (index >= tiles.size()) {
+            return;
+        }
+        composite_tile(tiles[index]);
+    }
+}
+
+/* Mirrors what the pixman render pass does for each operation, with the clip
+ * narrowed down to the tile. Images are created per tile, pixman images are
+ * not meant to be shared between threads. */
+void Renderer::TileCompositor::composite_tile(pixman_box32_t const& tile)
+{
+    pixman_image_t* target
+        = pixman_image_create_bits_no_clear(target_format, target_width,
+                                            target_height,
+                                            static_cast<uint32_t*>(target_data),
+                                            target_stride);
+
+    pixman_region32_t clip;
+    pixman_region32_init(&clip);
+
+    for (size_t i = 0; i < ops->size(); i++) {
+        RecordedOp const& op = (*ops)[i];
+
+        if (op.has_clip) {
+            pixman_region32_intersect_rect(&clip, &op.clip, tile.x1, tile.y1,
+                                           tile.x2 - tile.x1,
+                                           tile.y2 - tile.y1);
+        } else {
+            pixman_region32_fini(&clip);
+            pixman_region32_init_rect(&clip, tile.x1, tile.y1,
+                                      tile.x2 - tile.x1, tile.y2 - tile.y1);
+        }
+        if (!pixman_region32_not_empty(&clip)) {
+            continue;
+        }
+        pixman_image_set_clip_region32(target, &clip);
+
+        if (op.is_texture) {
+            Source const& source = sources[i];
+            pixman_image_t* image = pixman_image_create_bits_no_clear(
+                source.format, source.width, source.height,
+                static_cast<uint32_t*>(source.data), source.stride);
+
+            pixman_image_t* mask = nullptr;
+            if (op.alpha != 1.0) {
+                pixman_color const alpha = {
+                    .alpha = static_cast<uint16_t>(0xFFFF * op.alpha),
+                };
+                mask = pixman_image_create_solid_fill(&alpha);
+            }
+
+            wlr_box const& dst_box = op.texture.dst_box;
+            pixman_image_composite32(
+                PIXMAN_OP_OVER, image, mask, target,
+                static_cast<int>(op.texture.src_box.x),
+                static_cast<int>(op.texture.src_box.y), 0, 0, dst_box.x,
+                dst_box.y, dst_box.width, dst_box.height);
+
+            if (mask != nullptr) {
+                pixman_image_unref(mask);
+            }
+            pixman_image_unref(image);
+        } else {
+            wlr_render_rect_options const& rect = op.rect;
+            bool const replace = rect.color.a == 1
+                || rect.blend_mode == WLR_RENDER_BLEND_MODE_NONE;
+
+            pixman_color const color = {
+                .red = static_cast<uint16_t>(rect.color.r * 0xFFFF),
+                .green = static_cast<uint16_t>(rect.color.g * 0xFFFF),
+                .blue = static_cast<uint16_t>(rect.color.b * 0xFFFF),
+                .alpha = static_cast<uint16_t>(rect.color.a * 0xFFFF),
+            };
+            pixman_image_t* fill = pixman_image_create_solid_fill(&color);
+
+            wlr_box box = rect.box;
+            if (wlr_box_empty(&box)) {
+                box = { 0, 0, target_width, target_height };
+            }
+            pixman_image_composite32(replace ? PIXMAN_OP_SRC : PIXMAN_OP_OVER,
+                                     fill, nullptr, target, 0, 0, 0, 0, box.x,
+                                     box.y, box.width, box.height);
+            pixman_image_unref(fill);
+        }
+    }
+
+    pixman_region32_fini(&clip);
+    pixman_image_unref(target);
+}
@@ -0,0 +1,77 @@
+#ifndef NAOLAND_SOFTWARE_HPP
+#define NAOLAND_SOFTWARE_HPP
+
+#include "rendering/renderer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "wlr-wrap-start.hpp"
+#include <pixman.h>
+#include <wlr/types/wlr_buffer.h>
+#include "wlr-wrap-end.hpp"
+
+namespace Renderer {
+
+/*
+ * CPU compositing for the pixman renderer. The operations of a frame are
+ * recorded on the main thread (see NodeRenderOptions::recording), then the
+ * damaged part of the output is split in tiles composited by a pool of worker
+ * threads. Each tile replays every operation clipped to itself, in order, the
+ * same way the pixman render pass would, so the result does not depend on how
+ * the output was split.
+ */
+class TileCompositor {
+public:
+    explicit TileCompositor(int thread_count);
+    ~TileCompositor();
+
+    TileCompositor(TileCompositor const&) = delete;
+    TileCompositor& operator=(TileCompositor const&) = delete;
+
+    bool begin(std::vector<RecordedOp> const& ops);
+    bool composite(wlr_buffer* target, pixman_region32_t const* damage);
+    void end();
+
+private:
+    /* Source pixels of a texture operation, read by every worker */
+    struct Source {
+        wlr_buffer* buffer;
+        pixman_format_code_t format;
+        void* data;
+        int width;
+        int height;
+        int stride;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    bool stopping = false;
+    uint64_t job = 0;
+    int pending_workers = 0;
+
+    /* The current frame, only written while no worker is running */
+    std::vector<RecordedOp> const* ops = nullptr;
+    std::vector<Source> sources;
+    std::vector<pixman_box32_t> tiles;
+    std::atomic<size_t> next_tile = 0;
+    pixman_format_code_t target_format = {};
+    void* target_data = nullptr;
+    int target_width = 0;
+    int target_height = 0;
+    int target_stride = 0;
+
+    void worker_main();
+    void run_tiles();
+    void composite_tile(pixman_box32_t const& tile);
+};
+
+}
+
+#endif
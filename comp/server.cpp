@@ -2,6 +2,7 @@
 
 #include "input/seat.hpp"
 #include "output.hpp"
+#include "rendering/software.hpp"
 #include "surface/layer.hpp"
 #include "surface/popup.hpp"
 #include "surface/surface.hpp"
@@ -11,12 +12,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <ctime>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "wlr-wrap-start.hpp"
 #include <wayland-server-core.h>
 #include <wlr/backend/session.h>
+#include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_data_control_v1.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_export_dmabuf_v1.h>
@@ -25,6 +31,7 @@
 #include <wlr/types/wlr_primary_selection_v1.h>
 #include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_single_pixel_buffer_v1.h>
+#include <wlr/types/wlr_subcompositor.h>
 #include <wlr/types/wlr_viewporter.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_foreign_registry.h>
@@ -68,13 +75,16 @@ void Server::focus_view(View* view, wlr_surface* surface)
 
     /* Move the view to the front */
     wlr_scene_node_raise_to_top(&view->scene_tree->node);
-    std::ranges::remove(views, view);
-    for (auto* it : std::as_const(views)) {
-        it->set_activated(false);
+    scene_generation++;
+    surface_index.mark_restacked();
+    if (focused_view != nullptr && focused_view != view) {
+        focused_view->set_activated(false);
     }
 
     /* Activate the new surface */
-    views.insert(views.begin(), view);
+    if (task_switch_view == nullptr) {
+        view->raise_in_workspace();
+    }
     view->set_activated(true);
     focused_view = view;
 
@@ -97,35 +107,70 @@ void Server::focus_view(View* view, wlr_surface* surface)
 }
 
 Surface* Server::surface_at(double const lx, double const ly, wlr_surface** wlr,
-                            double* sx, double* sy) const
+                            double* sx, double* sy, wlr_box* exclusive)
 {
-    /* This returns the topmost node in the scene at the given layout coords.
-     * we only care about surface nodes as we are specifically looking for a
-     * surface in the surface tree of a naoland_view. */
-    wlr_scene_node* node = wlr_scene_node_at(&scene->tree.node, lx, ly, sx, sy);
-    if (node == nullptr || node->type != WLR_SCENE_NODE_BUFFER) {
-        return nullptr;
-    }
-    wlr_scene_buffer* scene_buffer = wlr_scene_buffer_from_node(node);
-    wlr_scene_surface const* scene_surface
-        = wlr_scene_surface_try_from_buffer(scene_buffer);
-    if (!scene_surface) {
-        return nullptr;
+    return surface_index.at(lx, ly, wlr, sx, sy, exclusive);
+}
+
+/* Whether `a` should be tried before `b` under `policy` */
+static bool mode_before(wlr_output_mode const* a, wlr_output_mode const* b,
+                        OutputModePolicy const policy)
+{
+    int64_t const area_a = static_cast<int64_t>(a->width) * a->height;
+    int64_t const area_b = static_cast<int64_t>(b->width) * b->height;
+
+    switch (policy) {
+    case NAOLAND_OUTPUT_MODE_PREFERRED:
+        if (a->preferred != b->preferred) {
+            return a->preferred;
+        }
+        break;
+    case NAOLAND_OUTPUT_MODE_HIGHEST_REFRESH:
+        if (a->refresh != b->refresh) {
+            return a->refresh > b->refresh;
+        }
+        break;
+    case NAOLAND_OUTPUT_MODE_HIGHEST_RESOLUTION:
+        break;
     }
 
-    *wlr = scene_surface->surface;
-    /* Find the node corresponding to the naoland_view at the root of this
-     * surface tree, it is the only one for which we set the data field. */
-    wlr_scene_tree const* tree = node->parent;
-    while (tree != nullptr && tree->node.data == nullptr) {
-        tree = tree->node.parent;
+    if (area_a != area_b) {
+        return area_a > area_b;
     }
+    return a->refresh > b->refresh;
+}
 
-    if (tree != nullptr) {
-        return static_cast<Surface*>(tree->node.data);
+/* Enables a new output with a single modeset: modes are only tested until one
+ * is accepted, and that one is committed. Some backends don't have modes, in
+ * which case the output is just enabled. */
+static bool enable_new_output(wlr_output& wlr, OutputModePolicy const policy)
+{
+    std::vector<wlr_output_mode*> modes;
+    wlr_output_mode* mode;
+    wl_list_for_each(mode, &wlr.modes, link)
+    {
+        modes.push_back(mode);
+    }
+    std::ranges::stable_sort(modes, [policy](auto const* a, auto const* b) {
+        return mode_before(a, b, policy);
+    });
+
+    wlr_output_state state;
+    wlr_output_state_init(&state);
+    wlr_output_state_set_enabled(&state, true);
+
+    bool accepted = modes.empty();
+    for (auto* candidate : modes) {
+        wlr_output_state_set_mode(&state, candidate);
+        if (wlr_output_test_state(&wlr, &state)) {
+            accepted = true;
+            break;
+        }
     }
 
-    return nullptr;
+    accepted = accepted && wlr_output_commit_state(&wlr, &state);
+    wlr_output_state_finish(&state);
+    return accepted;
 }
 
 /* This event is raised by the backend when a new output (aka a display or
@@ -143,35 +188,18 @@ static void new_output_notify(wl_listener* listener, void* data)
      * and our renderer. Must be done once, before commiting the output */
     wlr_output_init_render(new_output, server.allocator, server.renderer);
 
-    /* Some backends don't have modes. DRM+KMS does, and we need to set a mode
-     * before we can use the output. The mode is a tuple of (width, height,
-     * refresh rate), and each monitor supports only a specific set of modes. We
-     * just pick the monitor's preferred mode, a more sophisticated compositor
-     * would let the user configure it. */
-    if (!wl_list_empty(&new_output->modes)) {
-        wlr_output_mode* mode = wlr_output_preferred_mode(new_output);
-        wlr_output_set_mode(new_output, mode);
-        wlr_output_enable(new_output, true);
-        if (!wlr_output_commit(new_output)) {
-            return;
-        }
+    /* The output is only committed once, with the first mode it accepts */
+    if (!enable_new_output(*new_output, server.config.output.mode)) {
+        wlr_log(WLR_ERROR, "No mode of output %s could be set",
+                new_output->name);
+        return;
     }
 
-    /* Allocates and configures our state for this output */
+    /* Allocates and configures our state for this output, which also adds it
+     * to the output layout */
     auto* output = new Output(server, *new_output);
     server.outputs.emplace(output);
 
-    /* Adds this to the output layout. The add_auto function arranges outputs
-     * from left-to-right in the order they appear. A more sophisticated
-     * compositor would let the user configure the arrangement of outputs in the
-     * layout.
-     *
-     * The output layout utility automatically adds a wl_output global to the
-     * display, which Wayland clients can see to find out information about the
-     * output (such as DPI, scale factor, manufacturer, etc).
-     */
-    wlr_output_layout_add_auto(server.output_layout, new_output);
-
     output->update_layout();
 }
 
@@ -191,6 +219,155 @@ static void output_power_manager_set_mode_notify(wl_listener*, void* data)
     }
 }
 
+/* What a commit can change about where a surface and its subsurfaces are
+ * drawn. Buffer contents are not part of it, they are read when drawing. */
+struct SurfacePlacement {
+    struct Subsurface {
+        wlr_subsurface const* subsurface;
+        int32_t x, y;
+        bool mapped;
+
+        bool operator==(Subsurface const&) const = default;
+    };
+
+    int width = 0, height = 0;
+    bool mapped = false;
+    /* xdg window geometry, which borders are drawn around, and the position
+     * of xdg popups */
+    int32_t geometry[4] = {};
+    int32_t popup[4] = {};
+    /* Bottom to top, the parent surface itself sits in between */
+    std::vector<Subsurface> subsurfaces;
+
+    bool operator==(SurfacePlacement const&) const = default;
+};
+
+static void box_to_array(wlr_box const& box, int32_t array[4])
+{
+    array[0] = box.x;
+    array[1] = box.y;
+    array[2] = box.width;
+    array[3] = box.height;
+}
+
+static void surface_placement_read(wlr_surface& surface,
+                                   SurfacePlacement& placement)
+{
+    placement.width = surface.current.width;
+    placement.height = surface.current.height;
+    placement.mapped = surface.mapped;
+
+    if (auto const* xdg = wlr_xdg_surface_try_from_wlr_surface(&surface)) {
+        box_to_array(xdg->current.geometry, placement.geometry);
+        if (xdg->role == WLR_XDG_SURFACE_ROLE_POPUP && xdg->popup != nullptr) {
+            box_to_array(xdg->popup->current.geometry, placement.popup);
+        }
+    }
+
+    placement.subsurfaces.clear();
+    wlr_subsurface const* subsurface;
+    wl_list_for_each(subsurface, &surface.current.subsurfaces_below,
+                     current.link)
+    {
+        placement.subsurfaces.push_back({ subsurface, subsurface->current.x,
+                                          subsurface->current.y,
+                                          subsurface->surface->mapped });
+    }
+    placement.subsurfaces.push_back({});
+    wl_list_for_each(subsurface, &surface.current.subsurfaces_above,
+                     current.link)
+    {
+        placement.subsurfaces.push_back({ subsurface, subsurface->current.x,
+                                          subsurface->current.y,
+                                          subsurface->surface->mapped });
+    }
+}
+
+/* Keeps Server::scene_generation up to date with client commits. A commit
+ * can resize a buffer or move a subsurface without any of our own code
+ * running, so every wl_surface gets one of these. Commits that only bring
+ * new contents, the bulk of them for video and games, leave it alone. */
+class SurfaceCommitTracker {
+public:
+    struct Listeners {
+        std::reference_wrapper<SurfaceCommitTracker> parent;
+        wl_listener commit = {};
+        wl_listener destroy = {};
+        explicit Listeners(SurfaceCommitTracker& parent) noexcept
+            : parent(parent)
+        {
+        }
+    };
+
+private:
+    Listeners listeners;
+
+public:
+    Server& server;
+    wlr_surface& surface;
+    SurfacePlacement placement;
+    /* Reused by every commit */
+    SurfacePlacement next_placement;
+
+    SurfaceCommitTracker(Server& server, wlr_surface& surface) noexcept;
+    ~SurfaceCommitTracker() noexcept;
+};
+
+static void surface_commit_tracker_commit_notify(wl_listener* listener, void*)
+{
+    SurfaceCommitTracker& tracker
+        = naoland_container_of(listener, tracker, commit);
+
+    surface_placement_read(tracker.surface, tracker.next_placement);
+    if (tracker.next_placement == tracker.placement) {
+        return;
+    }
+    std::swap(tracker.placement, tracker.next_placement);
+    tracker.server.scene_generation++;
+
+    /* Subsurfaces change the bounds of the surface they are attached to */
+    void* const data = wlr_surface_get_root_surface(&tracker.surface)->data;
+    if (data != nullptr) {
+        tracker.server.surface_index.mark_dirty(*static_cast<Surface*>(data));
+    }
+}
+
+static void surface_commit_tracker_destroy_notify(wl_listener* listener, void*)
+{
+    SurfaceCommitTracker& tracker
+        = naoland_container_of(listener, tracker, destroy);
+
+    tracker.server.scene_generation++;
+    tracker.server.surface_index.mark_changed();
+    delete &tracker;
+}
+
+SurfaceCommitTracker::SurfaceCommitTracker(Server& server,
+                                           wlr_surface& surface) noexcept
+    : listeners(*this)
+    , server(server)
+    , surface(surface)
+{
+    listeners.commit.notify = surface_commit_tracker_commit_notify;
+    wl_signal_add(&surface.events.commit, &listeners.commit);
+    listeners.destroy.notify = surface_commit_tracker_destroy_notify;
+    wl_signal_add(&surface.events.destroy, &listeners.destroy);
+}
+
+SurfaceCommitTracker::~SurfaceCommitTracker() noexcept
+{
+    wl_list_remove(&listeners.commit.link);
+    wl_list_remove(&listeners.destroy.link);
+}
+
+static void new_surface_notify(wl_listener* listener, void* data)
+{
+    Server& server
+        = naoland_container_of(listener, server, compositor_new_surface);
+
+    new SurfaceCommitTracker(server, *static_cast<wlr_surface*>(data));
+}
+
 /* This event is raised when wlr_xdg_shell receives a new xdg surface from a
  * client, either a toplevel (application window) or popup. */
 static void new_xdg_surface_notify(wl_listener* listener, void* data)
@@ -272,15 +449,9 @@ static void drm_lease_notify(wl_listener* listener, void* data)
     }
 }
 
-void output_layout_change_notify(wl_listener* listener, void*)
+/* Tells output management clients about the current layout */
+static void send_output_configuration(Server& server)
 {
-    Server& server
-        = naoland_container_of(listener, server, output_layout_change);
-
-    if (server.num_pending_output_layout_changes > 0) {
-        return;
-    }
-
     wlr_output_configuration_v1* config = wlr_output_configuration_v1_create();
 
     for (auto const* output : std::as_const(server.outputs)) {
@@ -298,67 +469,244 @@ void output_layout_change_notify(wl_listener* listener, void*)
     wlr_output_manager_v1_set_configuration(server.output_manager, config);
 }
 
-void output_manager_apply_notify(wl_listener* listener, void* data)
+static int output_layout_timer_notify(void* data)
+{
+    Server& server = *static_cast<Server*>(data);
+
+    for (auto* output : server.outputs) {
+        if (output->wlr.enabled) {
+            output->update_layout();
+        }
+    }
+    send_output_configuration(server);
+
+    return 0;
+}
+
+/* Docks connect and disconnect several outputs in a row, and some flap their
+ * connectors while doing so. Outputs follow their new place right away, but
+ * what is on them is only re-placed, and clients told about the new
+ * configuration, once things settle */
+void output_layout_change_notify(wl_listener* listener, void*)
 {
     Server& server
-        = naoland_container_of(listener, server, output_manager_apply);
-    auto& config = *static_cast<wlr_output_configuration_v1*>(data);
+        = naoland_container_of(listener, server, output_layout_change);
 
-    server.num_pending_output_layout_changes++;
+    if (server.num_pending_output_layout_changes > 0) {
+        return;
+    }
 
-    wlr_output_configuration_head_v1* head;
-    wl_list_for_each(head, &config.heads, link)
-    {
-        Output& output = *static_cast<Output*>(head->state.output->data);
-        bool const enabled = head->state.enabled && !output.is_leased;
-        bool const adding = enabled && !output.wlr.enabled;
-        bool const removing = !enabled && output.wlr.enabled;
-
-        wlr_output_enable(&output.wlr, enabled);
-        if (enabled) {
-            if (head->state.mode) {
-                wlr_output_set_mode(&output.wlr, head->state.mode);
-            } else {
-                int32_t const width = head->state.custom_mode.width;
-                int32_t const height = head->state.custom_mode.height;
-                int32_t const refresh = head->state.custom_mode.refresh;
-                wlr_output_set_custom_mode(&output.wlr, width, height, refresh);
-            }
+    for (auto* output : server.outputs) {
+        if (output->wlr.enabled) {
+            output->update_full_area();
+        }
+    }
+
+    if (server.output_layout_timer == nullptr) {
+        output_layout_timer_notify(&server);
+        return;
+    }
+    wl_event_source_timer_update(server.output_layout_timer,
+                                 server.config.output.hotplug_debounce);
+}
+
+/* One head of an output configuration, with what committing it changes and
+ * what it takes to go back */
+struct HeadTransaction {
+    Output* output;
+    wlr_output_configuration_head_v1 const* head;
+    bool enabled;
+    wlr_output_state state;
+    wlr_output_state rollback;
+};
+
+/* Only what differs from the current state goes into `state`, so heads that
+ * are left as they are do not get a modeset */
+static void head_transaction_init(HeadTransaction& transaction)
+{
+    wlr_output const& wlr = transaction.output->wlr;
+    auto const& head = transaction.head->state;
+    wlr_output_state& state = transaction.state;
+    wlr_output_state& rollback = transaction.rollback;
+    wlr_output_state_init(&state);
+    wlr_output_state_init(&rollback);
+
+    if (transaction.enabled != wlr.enabled) {
+        wlr_output_state_set_enabled(&state, transaction.enabled);
+        wlr_output_state_set_enabled(&rollback, wlr.enabled);
+    }
+    if (!transaction.enabled) {
+        return;
+    }
 
-            wlr_output_set_scale(&output.wlr, head->state.scale);
-            wlr_output_set_transform(&output.wlr, head->state.transform);
+    if (head.mode != nullptr) {
+        if (head.mode != wlr.current_mode) {
+            wlr_output_state_set_mode(&state, head.mode);
         }
+    } else if (head.custom_mode.width != wlr.width
+               || head.custom_mode.height != wlr.height
+               || head.custom_mode.refresh != wlr.refresh) {
+        wlr_output_state_set_custom_mode(&state, head.custom_mode.width,
+                                         head.custom_mode.height,
+                                         head.custom_mode.refresh);
+    }
+    if (state.committed & WLR_OUTPUT_STATE_MODE) {
+        if (wlr.current_mode != nullptr) {
+            wlr_output_state_set_mode(&rollback, wlr.current_mode);
+        } else {
+            wlr_output_state_set_custom_mode(&rollback, wlr.width, wlr.height,
+                                             wlr.refresh);
+        }
+    }
+
+    if (head.scale != wlr.scale) {
+        wlr_output_state_set_scale(&state, head.scale);
+        wlr_output_state_set_scale(&rollback, wlr.scale);
+    }
+    if (head.transform != wlr.transform) {
+        wlr_output_state_set_transform(&state, head.transform);
+        wlr_output_state_set_transform(&rollback, wlr.transform);
+    }
+}
 
-        if (!wlr_output_commit(&output.wlr)) {
-            wlr_log(WLR_ERROR, "Output config commit failed");
+/* Builds the state of every head of `config` and tests all of them, nothing is
+ * committed. Returns false as soon as one head would fail. */
+static bool output_configuration_test(wlr_output_configuration_v1& config,
+                                      std::vector<HeadTransaction>& heads)
+{
+    heads.reserve(wl_list_length(&config.heads));
+    wlr_output_configuration_head_v1* head;
+    wl_list_for_each(head, &config.heads, link)
+    {
+        auto* output = static_cast<Output*>(head->state.output->data);
+        if (output == nullptr) {
             continue;
         }
 
-        if (adding) {
-            wlr_output_layout_add_auto(server.output_layout, &output.wlr);
-            output.scene_output
-                = wlr_scene_get_scene_output(server.scene, &output.wlr);
+        heads.push_back({
+            .output = output,
+            .head = head,
+            .enabled = head->state.enabled && !output->is_leased,
+            .state = {},
+            .rollback = {},
+        });
+        head_transaction_init(heads.back());
+    }
+
+    return std::ranges::all_of(heads, [](HeadTransaction& transaction) {
+        return transaction.state.committed == 0
+            || wlr_output_test_state(&transaction.output->wlr,
+                                     &transaction.state);
+    });
+}
+
+static void output_configuration_finish(std::vector<HeadTransaction>& heads)
+{
+    for (auto& transaction : heads) {
+        wlr_output_state_finish(&transaction.state);
+        wlr_output_state_finish(&transaction.rollback);
+    }
+}
+
+void output_manager_test_notify(wl_listener*, void* data)
+{
+    auto& config = *static_cast<wlr_output_configuration_v1*>(data);
+
+    std::vector<HeadTransaction> heads;
+    if (output_configuration_test(config, heads)) {
+        wlr_output_configuration_v1_send_succeeded(&config);
+    } else {
+        wlr_output_configuration_v1_send_failed(&config);
+    }
+    output_configuration_finish(heads);
+    wlr_output_configuration_v1_destroy(&config);
+}
+
+/* Applies a configuration to all heads or none of them: every head is tested
+ * before anything is committed, and heads already committed are put back if a
+ * later commit still fails. The layout, scene outputs and cursor themes are
+ * only updated once everything went through. */
+void output_manager_apply_notify(wl_listener* listener, void* data)
+{
+    Server& server
+        = naoland_container_of(listener, server, output_manager_apply);
+    auto& config = *static_cast<wlr_output_configuration_v1*>(data);
+
+    std::vector<HeadTransaction> heads;
+    if (!output_configuration_test(config, heads)) {
+        wlr_log(WLR_ERROR, "Output configuration test failed");
+        wlr_output_configuration_v1_send_failed(&config);
+        output_configuration_finish(heads);
+        wlr_output_configuration_v1_destroy(&config);
+        return;
+    }
+
+    auto failed = heads.end();
+    for (auto it = heads.begin(); it != heads.end(); ++it) {
+        if (it->state.committed != 0
+            && !wlr_output_commit_state(&it->output->wlr, &it->state)) {
+            failed = it;
+            break;
         }
+    }
+    if (failed != heads.end()) {
+        wlr_log(WLR_ERROR, "Output configuration commit failed, rolling back");
+        for (auto it = heads.begin(); it != failed; ++it) {
+            if (it->rollback.committed != 0) {
+                wlr_output_commit_state(&it->output->wlr, &it->rollback);
+            }
+        }
+        wlr_output_configuration_v1_send_failed(&config);
+        output_configuration_finish(heads);
+        wlr_output_configuration_v1_destroy(&config);
+        return;
+    }
 
-        if (enabled) {
-            wlr_box box = {};
-            wlr_output_layout_get_box(server.output_layout, &output.wlr, &box);
-            if (box.x != head->state.x || box.y != head->state.y) {
-                /* This overrides the automatic layout */
-                wlr_output_layout_add(server.output_layout, &output.wlr,
-                                      head->state.x, head->state.y);
+    /* Layout changes are reported to clients once, for the whole
+     * configuration */
+    server.num_pending_output_layout_changes++;
+    for (auto const& transaction : heads) {
+        Output& output = *transaction.output;
+        auto const& head = transaction.head->state;
+
+        if (!transaction.enabled) {
+            if (wlr_output_layout_get(server.output_layout, &output.wlr)
+                != nullptr) {
+                wlr_output_layout_remove(server.output_layout, &output.wlr);
+                output.scene_output = nullptr;
             }
+            continue;
         }
 
-        if (removing) {
-            wlr_output_layout_remove(server.output_layout, &output.wlr);
-            output.scene_output = nullptr;
+        wlr_box box = {};
+        wlr_output_layout_get_box(server.output_layout, &output.wlr, &box);
+        if (wlr_box_empty(&box) || box.x != head.x || box.y != head.y) {
+            /* This overrides the automatic layout */
+            wlr_output_layout_output* layout_output = wlr_output_layout_add(
+                server.output_layout, &output.wlr, head.x, head.y);
+            /* The scene output went away with the output's place in the
+             * layout when it was disabled */
+            if (wlr_scene_get_scene_output(server.scene, &output.wlr)
+                == nullptr) {
+                wlr_scene_output_layout_add_output(
+                    server.scene_layout, layout_output,
+                    wlr_scene_output_create(server.scene, &output.wlr));
+            }
         }
+        output.scene_output
+            = wlr_scene_get_scene_output(server.scene, &output.wlr);
     }
+    server.num_pending_output_layout_changes--;
 
     wlr_output_configuration_v1_send_succeeded(&config);
+    output_configuration_finish(heads);
     wlr_output_configuration_v1_destroy(&config);
 
+    if (server.output_layout_timer != nullptr) {
+        wl_event_source_timer_update(server.output_layout_timer, 0);
+    }
+    output_layout_timer_notify(&server);
+
     for (auto* output : server.outputs) {
         wlr_xcursor_manager_load(server.seat->cursor.cursor_mgr,
                                  output->wlr.scale);
@@ -375,22 +723,143 @@ static void new_toplevel_decoration_notify(wl_listener*, void* data)
     view->setup_decorations(decoration);
 }
 
-void Server::switch_workspace(int number)
+/* The output under the cursor, which workspace switches and new views go
+ * to */
+Output* Server::active_output() const
+{
+    Cursor const& cursor = seat->cursor;
+    wlr_output* wlr = wlr_output_layout_output_at(output_layout, cursor.wlr.x,
+                                                  cursor.wlr.y);
+    if (wlr != nullptr && wlr->data != nullptr) {
+        return static_cast<Output*>(wlr->data);
+    }
+
+    return outputs.empty() ? nullptr : *outputs.begin();
+}
+
+Workspace& Server::active_workspace()
+{
+    Output const* output = active_output();
+    if (output == nullptr || output->active_workspace == nullptr) {
+        return unassigned;
+    }
+
+    return *output->active_workspace;
+}
+
+void Server::switch_workspace(int const number)
 {
-    if (number > WORKSPACE_COUNT) return;
-    if (number < 1) return;
-    number -= 1;
+    Output* output = active_output();
+    if (output != nullptr) {
+        output->switch_workspace(number);
+    }
+}
+
+/* Focuses the view after the current one in the order they were last used,
+ * starting over from the most recent one at the end. Called again while the
+ * same modifiers are held, it keeps going down the list. A binding without
+ * modifiers switches between the two most recent views. */
+void Server::switch_task(uint32_t const modifiers)
+{
+    Workspace const& workspace = active_workspace();
+    View* from = task_switch_view != nullptr ? task_switch_view : focused_view;
+    if (from == nullptr || from->workspace != &workspace) {
+        from = workspace.views;
+    }
+    if (from == nullptr) {
+        return;
+    }
+
+    View* view = from;
+    do {
+        view = view->mru_next != nullptr ? view->mru_next : workspace.views;
+    } while (view != from && view->is_minimized);
+    if (view == from) {
+        return;
+    }
+
+    /* Without modifiers there is no release to end the switch on, so it ends
+     * right away and the view is raised like any other focus change */
+    if (modifiers != 0) {
+        task_switch_view = view;
+        task_switch_modifiers = modifiers;
+    } else {
+        task_switch_view = nullptr;
+    }
+    focus_view(view);
+}
+
+/* Called when the keyboard modifiers change, the task switch ends with the
+ * release of the ones it was started with */
+void Server::end_task_switch(uint32_t const modifiers)
+{
+    if (task_switch_view == nullptr
+        || (modifiers & task_switch_modifiers) == task_switch_modifiers) {
+        return;
+    }
 
-    for (int j = 0; j < WORKSPACE_COUNT; ++j) {
-        wlr_scene_node_set_enabled(&workspaces[j].scene_tree->node, j == number);
-        if (j == number) {
-            scene_layers[NAOLAND_SCENE_LAYER_NORMAL] = workspaces[j].scene_tree;
+    task_switch_view = nullptr;
+    if (focused_view != nullptr) {
+        focused_view->raise_in_workspace();
+    }
+}
+
+/* Buffers the scene does not answer frame callbacks for: disabled (on another
+ * workspace or minimized), off every output or fully occluded */
+static void send_hidden_frame_done(wlr_scene_node* node, bool enabled,
+                                   timespec const* now)
+{
+    enabled = enabled && node->enabled;
+
+    switch (node->type) {
+    case WLR_SCENE_NODE_TREE: {
+        wlr_scene_tree* tree = wlr_scene_tree_from_node(node);
+        wlr_scene_node* child = {};
+        wl_list_for_each(child, &tree->children, link)
+        {
+            send_hidden_frame_done(child, enabled, now);
         }
+    } break;
+    case WLR_SCENE_NODE_BUFFER: {
+        wlr_scene_buffer* scene_buffer = wlr_scene_buffer_from_node(node);
+        if (!enabled || scene_buffer->primary_output == nullptr) {
+            wlr_scene_buffer_send_frame_done(scene_buffer, now);
+        }
+    } break;
+    case WLR_SCENE_NODE_RECT:
+        break;
+    }
+}
+
+static int hidden_frame_timer_notify(void* data)
+{
+    Server& server = *static_cast<Server*>(data);
+
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    /* Trees of views being mapped or unmapped sit on the normal layer itself,
+     * every workspace is below it */
+    wlr_scene_tree* normal = server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL];
+    int lx, ly;
+    bool const enabled = wlr_scene_node_coords(&normal->node, &lx, &ly);
+    send_hidden_frame_done(&normal->node, enabled, &now);
+
+    wl_event_source_timer_update(
+        server.hidden_frame_timer,
+        server.config.frame_timing.hidden_frame_interval);
+    return 0;
+}
+
+void Server::add_damage(wlr_box const& box) const
+{
+    for (auto* output : outputs) {
+        output->add_damage(box);
     }
 }
 
 Server::Server()
     : listeners(*this)
+    , surface_index(*this)
 {
     /* The Wayland display is managed by libwayland. It handles accepting
      * clients from the Unix socket, manging Wayland globals, and so on. */
@@ -420,6 +889,16 @@ Server::Server()
     allocator = wlr_allocator_autocreate(backend, renderer);
     assert(allocator);
 
+    if (wlr_renderer_is_pixman(renderer)) {
+        int threads = config.software.render_threads;
+        if (threads <= 0) {
+            threads = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        if (threads > 1) {
+            tile_compositor = new Renderer::TileCompositor(threads);
+        }
+    }
+
     /* This creates some hands-off wlroots interfaces. The compositor is
      * necessary for clients to allocate surfaces, the subcompositor allows to
      * assign the role of subsurfaces to surfaces and the data device manager
@@ -428,6 +907,9 @@ Server::Server()
      * that the clients cannot set the selection directly without compositor
      * approval, see the handling of the request_set_selection event below.*/
     compositor = wlr_compositor_create(display, 6, renderer);
+    listeners.compositor_new_surface.notify = new_surface_notify;
+    wl_signal_add(&compositor->events.new_surface,
+                  &listeners.compositor_new_surface);
     wlr_subcompositor_create(display);
     wlr_data_device_manager_create(display);
 
@@ -447,6 +929,9 @@ Server::Server()
     listeners.output_manager_apply.notify = output_manager_apply_notify;
     wl_signal_add(&output_manager->events.apply,
                   &listeners.output_manager_apply);
+    listeners.output_manager_test.notify = output_manager_test_notify;
+    wl_signal_add(&output_manager->events.test,
+                  &listeners.output_manager_test);
 
     output_power_manager = wlr_output_power_manager_v1_create(display);
     listeners.output_power_manager_set_mode.notify
@@ -470,30 +955,21 @@ Server::Server()
     scene = wlr_scene_create();
     assert(scene);
     for (int32_t idx = 0; idx <= NAOLAND_SCENE_LAYER_LOCK; idx++) {
-        if (idx == NAOLAND_SCENE_LAYER_NORMAL) {
-            for (int j = 0; j < WORKSPACE_COUNT; ++j) {
-                workspaces[j] = Workspace {
-                    .number = j,
-                    .scene_tree = wlr_scene_tree_create(&scene->tree),
-                };
-                wlr_scene_node_raise_to_top(&workspaces[j].scene_tree->node);
-
-                if (j != 0) {
-                    wlr_scene_node_set_enabled(&workspaces[j].scene_tree->node, false);
-                }
-            }
-
-            scene_layers[idx] = workspaces[0].scene_tree;
-            continue;
-        }
-
         scene_layers[idx] = wlr_scene_tree_create(&scene->tree);
         wlr_scene_node_raise_to_top(&scene_layers[idx]->node);
     }
+    unassigned = Workspace {
+        .number = 1,
+        .output = nullptr,
+        .scene_tree
+        = wlr_scene_tree_create(scene_layers[NAOLAND_SCENE_LAYER_NORMAL]),
+    };
+    /* Holds views mapped while no output exists, never shown */
+    wlr_scene_node_set_enabled(&unassigned.scene_tree->node, false);
 
     scene_layout = wlr_scene_attach_output_layout(scene, output_layout);
 
-    auto* presentation = wlr_presentation_create(display, backend);
+    presentation = wlr_presentation_create(display, backend);
     assert(presentation);
     wlr_scene_set_presentation(scene, presentation);
 
@@ -548,4 +1024,18 @@ Server::Server()
     }
 
     content_type_manager = wlr_content_type_manager_v1_create(display, 1);
+
+    if (config.output.hotplug_debounce > 0) {
+        output_layout_timer = wl_event_loop_add_timer(
+            wl_display_get_event_loop(display), output_layout_timer_notify,
+            this);
+    }
+
+    if (config.frame_timing.hidden_frame_interval > 0) {
+        hidden_frame_timer = wl_event_loop_add_timer(
+            wl_display_get_event_loop(display), hidden_frame_timer_notify,
+            this);
+        wl_event_source_timer_update(
+            hidden_frame_timer, config.frame_timing.hidden_frame_interval);
+    }
 }
@@ -2,10 +2,10 @@
 #define NAOLAND_SERVER_HPP
 
 #include "config.hpp"
+#include "surface/surface_index.hpp"
 #include "types.hpp"
 
 #include <functional>
-#include <list>
 #include <set>
 
 #include "wlr-wrap-start.hpp"
@@ -19,6 +19,7 @@
 #include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/types/wlr_output_management_v1.h>
 #include <wlr/types/wlr_output_power_management_v1.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_xdg_activation_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
@@ -34,17 +35,24 @@ enum NaolandSceneLayer {
     NAOLAND_SCENE_LAYER_LOCK
 };
 
-#define WORKSPACE_COUNT 10
-
+/* Workspaces belong to an output, which creates them when first switched or
+ * moved to and destroys them once they are empty and hidden. Their trees are
+ * children of the normal scene layer. */
 struct Workspace {
     int number;
+    /* nullptr for Server::unassigned */
+    Output* output;
     wlr_scene_tree* scene_tree;
+    /* Mapped views, most recently focused first, linked through
+     * View::mru_next and View::mru_prev */
+    View* views = nullptr;
 };
 
 class Server {
 public:
     struct Listeners {
         std::reference_wrapper<Server> parent;
+        wl_listener compositor_new_surface = {};
         wl_listener xdg_shell_new_xdg_surface = {};
         wl_listener layer_shell_new_layer_surface = {};
         wl_listener activation_request_activation = {};
@@ -52,6 +60,7 @@ public:
         wl_listener drm_lease_request = {};
         wl_listener output_layout_change = {};
         wl_listener output_manager_apply = {};
+        wl_listener output_manager_test = {};
         wl_listener output_power_manager_set_mode = {};
         wl_listener decoration_manager_new_toplevel_decoration = {};
         explicit Listeners(Server& parent) noexcept
@@ -69,28 +78,49 @@ public:
     wlr_backend* backend;
     wlr_renderer* renderer;
     wlr_allocator* allocator;
+    /* Only with the pixman renderer, see Renderer::TileCompositor */
+    Renderer::TileCompositor* tile_compositor = nullptr;
     wlr_compositor* compositor;
 
     XWayland* xwayland;
 
-    Workspace workspaces[WORKSPACE_COUNT];
     wlr_scene* scene;
     wlr_scene_output_layout* scene_layout;
     wlr_scene_tree* scene_layers[NAOLAND_SCENE_LAYER_LOCK + 1] = {};
+    /* Views mapped while there is no output, or left without one, until an
+     * output shows up to take them */
+    Workspace unassigned = {};
+    wlr_presentation* presentation;
+    /* Bumped whenever a surface commits or is moved around in the scene, so
+     * anything derived from scene geometry knows when to recompute it */
+    uint64_t scene_generation = 1;
+    /* Sends frame callbacks to views hidden from every output at a low rate,
+     * visible ones get theirs from the output they are shown on */
+    wl_event_source* hidden_frame_timer = nullptr;
 
     wlr_xdg_shell* xdg_shell;
 
     wlr_xdg_activation_v1* xdg_activation;
 
     wlr_foreign_toplevel_manager_v1* foreign_toplevel_manager;
+    /* Handles with changes not sent yet, see
+     * ForeignToplevelHandle::flush_pending() */
+    std::set<ForeignToplevelHandle*> dirty_toplevel_handles;
 
     wlr_layer_shell_v1* layer_shell;
 
     Seat* seat;
 
-    std::list<View*> views;
+    /* Answers surface_at() without walking the whole scene */
+    SurfaceIndex surface_index;
+    /* Animations in progress, stepped before each output frame */
+    std::set<Animation*> animations;
     View* focused_view = nullptr;
     View* grabbed_view = nullptr;
+    /* While the task switcher cycles, the view it is on and the modifiers
+     * that keep it going. The order of the views stays put until it ends. */
+    View* task_switch_view = nullptr;
+    uint32_t task_switch_modifiers = 0;
     double grab_x = 0.0, grab_y = 0.0;
     wlr_box grab_geobox = {};
     uint32_t resize_edges = 0;
@@ -100,6 +130,9 @@ public:
     wlr_output_layout* output_layout;
     std::set<Output*> outputs;
     uint8_t num_pending_output_layout_changes = 0;
+    /* Rebuilds the layout once outputs stopped changing, see
+     * Config::output.hotplug_debounce */
+    wl_event_source* output_layout_timer = nullptr;
 
     wlr_idle_notifier_v1* idle_notifier;
     wlr_idle_inhibit_manager_v1* idle_inhibit_manager;
@@ -113,9 +146,14 @@ public:
     Server();
 
     Surface* surface_at(double lx, double ly, wlr_surface** wlr, double* sx,
-                        double* sy) const;
+                        double* sy, wlr_box* exclusive = nullptr);
     void focus_view(View* view, wlr_surface* surface = nullptr);
+    [[nodiscard]] Output* active_output() const;
+    [[nodiscard]] Workspace& active_workspace();
     void switch_workspace(int number);
+    void switch_task(uint32_t modifiers);
+    void end_task_switch(uint32_t modifiers);
+    void add_damage(wlr_box const& box) const;
 };
 
 #endif
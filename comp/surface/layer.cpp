@@ -88,8 +88,13 @@ static void wlr_layer_surface_v1_destroy_notify(wl_listener* listener, void*)
 {
     Layer& layer = naoland_container_of(listener, layer, destroy);
 
-    layer.output.layers.erase(&layer);
+    Output& output = layer.output;
+    output.layers.erase(&layer);
     delete &layer;
+    /* Nothing is left to arrange on an output going away */
+    if (!output.destroying) {
+        output.arrange_layers();
+    }
 }
 
 static void wlr_layer_surface_v1_commit_notify(wl_listener* listener, void*)
@@ -105,10 +110,12 @@ static void wlr_layer_surface_v1_commit_notify(wl_listener* listener, void*)
             = naoland_layer_from_wlr_layer(surface.current.layer);
         wlr_scene_node_reparent(&layer.scene_tree->node,
                                 server.scene_layers[chosen_layer]);
+        layer.server.surface_index.mark_restacked();
     }
 
-    if (committed) {
-        layer.output.update_layout();
+    /* Most commits only bring a new buffer, which does not move anything */
+    if (layer.arrangement_changed()) {
+        layer.output.arrange_layers();
     }
 }
 
@@ -132,7 +139,8 @@ static void wlr_layer_surface_v1_new_subsurface_notify(wl_listener* listener,
 }
 
 Layer::Layer(Output& output, wlr_layer_surface_v1& surface) noexcept
-    : listeners(*this)
+    : Surface(NAOLAND_SURFACE_TYPE_LAYER)
+    , listeners(*this)
     , server(output.server)
     , output(output)
     , layer_surface(surface)
@@ -145,6 +153,7 @@ Layer::Layer(Output& output, wlr_layer_surface_v1& surface) noexcept
 
     scene_tree->node.data = this;
     surface.surface->data = this;
+    server.surface_index.add(*this);
 
     listeners.map.notify = wlr_layer_surface_v1_map_notify;
     wl_signal_add(&surface.surface->events.map, &listeners.map);
@@ -164,6 +173,7 @@ Layer::Layer(Output& output, wlr_layer_surface_v1& surface) noexcept
 
 Layer::~Layer() noexcept
 {
+    server.surface_index.remove(*this);
     wl_list_remove(&listeners.map.link);
     wl_list_remove(&listeners.unmap.link);
     wl_list_remove(&listeners.destroy.link);
@@ -172,6 +182,27 @@ Layer::~Layer() noexcept
     wl_list_remove(&listeners.new_subsurface.link);
 }
 
+/* Whether the last commit changed anything the placement of this layer, or the
+ * area it leaves to others, depends on */
+bool Layer::arrangement_changed() const
+{
+    if (!arranged) {
+        return true;
+    }
+
+    wlr_layer_surface_v1_state const& current = layer_surface.current;
+    wlr_layer_surface_v1_state const& last = arranged_state;
+    return current.anchor != last.anchor
+        || current.exclusive_zone != last.exclusive_zone
+        || current.margin.top != last.margin.top
+        || current.margin.right != last.margin.right
+        || current.margin.bottom != last.margin.bottom
+        || current.margin.left != last.margin.left
+        || current.desired_width != last.desired_width
+        || current.desired_height != last.desired_height
+        || current.layer != last.layer;
+}
+
 constexpr wlr_surface* Layer::get_wlr_surface() const
 {
     return layer_surface.surface;
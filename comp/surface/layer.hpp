@@ -8,7 +8,9 @@
 #include <set>
 
 #include "wlr-wrap-start.hpp"
+#include <wlr/types/wlr_layer_shell_v1.h>
 #include <wlr/types/wlr_subcompositor.h>
+#include <wlr/util/box.h>
 #include "wlr-wrap-end.hpp"
 
 class Layer final : public Surface {
@@ -39,9 +41,19 @@ public:
 
     std::set<LayerSubsurface*> subsurfaces;
 
+    /* What this layer was last configured from, see Output::arrange_layers().
+     * `usable_before` is the usable area left by the layers arranged before
+     * it and `usable_after` what it left for the next ones. */
+    bool arranged = false;
+    wlr_layer_surface_v1_state arranged_state = {};
+    wlr_box usable_before = {};
+    wlr_box usable_after = {};
+
     Layer(Output& output, wlr_layer_surface_v1& surface) noexcept;
     ~Layer() noexcept override;
 
+    [[nodiscard]] bool arrangement_changed() const;
+
     [[nodiscard]] constexpr wlr_surface* get_wlr_surface() const override;
     [[nodiscard]] constexpr Server& get_server() const override;
     [[nodiscard]] constexpr bool is_view() const override;
@@ -25,7 +25,7 @@ static void popup_map_notify(wl_listener* listener, void*)
         wlr_box intersect = {};
         wlr_box_intersection(&intersect, &current, &output_area);
 
-        if (!wlr_box_empty(&current)) {
+        if (!wlr_box_empty(&intersect)) {
             wlr_surface_send_enter(popup.wlr.base->surface, &output->wlr);
         }
     }
@@ -46,7 +46,8 @@ static void popup_new_popup_notify(wl_listener* listener, void* data)
 }
 
 Popup::Popup(Surface const& parent, wlr_xdg_popup& wlr) noexcept
-    : listeners(*this)
+    : Surface(NAOLAND_SURFACE_TYPE_POPUP)
+    , listeners(*this)
     , server(parent.get_server())
     , parent(parent)
     , wlr(wlr)
@@ -58,6 +59,7 @@ Popup::Popup(Surface const& parent, wlr_xdg_popup& wlr) noexcept
 
     scene_tree->node.data = this;
     wlr.base->surface->data = this;
+    server.surface_index.add(*this);
 
     listeners.map.notify = popup_map_notify;
     wl_signal_add(&wlr.base->surface->events.map, &listeners.map);
@@ -69,6 +71,7 @@ Popup::Popup(Surface const& parent, wlr_xdg_popup& wlr) noexcept
 
 Popup::~Popup() noexcept
 {
+    server.surface_index.remove(*this);
     wl_list_remove(&listeners.map.link);
     wl_list_remove(&listeners.destroy.link);
     wl_list_remove(&listeners.new_popup.link);
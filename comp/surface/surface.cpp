@@ -0,0 +1,107 @@
+#include "surface.hpp"
+
+#include "server.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+
+#include "wlr-wrap-start.hpp"
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
+#include "wlr-wrap-end.hpp"
+
+static void extend_bounds(wlr_scene_buffer* buffer, int sx, int sy, void* data)
+{
+    auto& bounds = *static_cast<wlr_box*>(data);
+
+    int width = buffer->dst_width;
+    int height = buffer->dst_height;
+    if ((width <= 0 || height <= 0) && buffer->buffer != nullptr) {
+        bool const rotated = buffer->transform & WL_OUTPUT_TRANSFORM_90;
+        width = rotated ? buffer->buffer->height : buffer->buffer->width;
+        height = rotated ? buffer->buffer->width : buffer->buffer->height;
+    }
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    if (wlr_box_empty(&bounds)) {
+        bounds = { sx, sy, width, height };
+        return;
+    }
+
+    int const x1 = std::min(bounds.x, sx);
+    int const y1 = std::min(bounds.y, sy);
+    int const x2 = std::max(bounds.x + bounds.width, sx + width);
+    int const y2 = std::max(bounds.y + bounds.height, sy + height);
+    bounds = { x1, y1, x2 - x1, y2 - y1 };
+}
+
+/* Returns the layout-space box covering every enabled buffer of this surface's
+ * scene tree, including the window borders for views. */
+wlr_box Surface::get_bounds() const
+{
+    wlr_box bounds = {};
+    int lx, ly;
+    if (scene_tree == nullptr
+        || !wlr_scene_node_coords(&scene_tree->node, &lx, &ly)) {
+        return bounds;
+    }
+
+    wlr_scene_node_for_each_buffer(&scene_tree->node, extend_bounds, &bounds);
+    if (wlr_box_empty(&bounds)) {
+        return bounds;
+    }
+
+    /* The iterator reports positions relative to the parent of the tree */
+    bounds.x += lx - scene_tree->node.x;
+    bounds.y += ly - scene_tree->node.y;
+
+    if (type == NAOLAND_SURFACE_TYPE_VIEW) {
+        int const border = get_server().config.border.width;
+        bounds.x -= border;
+        bounds.y -= border;
+        bounds.width += border * 2;
+        bounds.height += border * 2;
+    }
+
+    return bounds;
+}
+
+/* Same as get_bounds(), but only walks the scene tree again when something in
+ * the scene may have moved since the last call. */
+wlr_box Surface::get_cached_bounds()
+{
+    Server const& server = get_server();
+    if (bounds_generation != server.surface_index.generation()) {
+        cached_bounds = get_bounds();
+        bounds_generation = server.surface_index.generation();
+    }
+
+    return cached_bounds;
+}
+
+/* The scene graph only damages the buffers it knows about. Everything drawn by
+ * the renderer on top of that (borders, animated boxes) has to be damaged by
+ * hand, both where it is now and where it was drawn last. */
+void Surface::damage()
+{
+    Server& server = get_server();
+
+    /* Most calls come with a commit that only brought new contents */
+    wlr_box const bounds = get_bounds();
+    if (!wlr_box_equal(&bounds, &damaged_area)) {
+        server.scene_generation++;
+        server.surface_index.mark_dirty(*this);
+    }
+
+    if (!wlr_box_empty(&damaged_area)) {
+        server.add_damage(damaged_area);
+    }
+    if (!wlr_box_empty(&bounds)) {
+        server.add_damage(bounds);
+    }
+
+    damaged_area = bounds;
+}
@@ -3,8 +3,11 @@
 
 #include "types.hpp"
 
+#include <cstdint>
+
 #include "wlr-wrap-start.hpp"
 #include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
 #include "wlr-wrap-end.hpp"
 
 enum SurfaceType {
@@ -14,14 +17,30 @@ enum SurfaceType {
 };
 
 struct Surface {
+    /* Lets hot paths like the renderer tell surfaces apart without RTTI */
+    SurfaceType const type;
     wlr_scene_tree* scene_tree = nullptr;
+    /* Layout-space area this surface was last drawn over, see damage() */
+    wlr_box damaged_area = {};
+    /* get_bounds() result, valid while bounds_generation matches the surface
+     * index generation */
+    wlr_box cached_bounds = {};
+    uint64_t bounds_generation = 0;
 
+    explicit Surface(SurfaceType type) noexcept
+        : type(type)
+    {
+    }
     virtual ~Surface() noexcept = default;
 
     [[nodiscard]] virtual constexpr Server& get_server() const = 0;
     [[nodiscard]] virtual constexpr wlr_surface* get_wlr_surface() const = 0;
     [[nodiscard]] virtual constexpr bool is_view() const = 0;
     [[nodiscard]] virtual constexpr bool is_popup() const = 0;
+
+    [[nodiscard]] wlr_box get_bounds() const;
+    [[nodiscard]] wlr_box get_cached_bounds();
+    void damage();
 };
 
 #endif
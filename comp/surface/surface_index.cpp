@@ -0,0 +1,404 @@
+#include "surface_index.hpp"
+
+#include "server.hpp"
+#include "surface.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "wlr-wrap-start.hpp"
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
+#include "wlr-wrap-end.hpp"
+
+/* Cells are 256 pixels wide */
+static constexpr int CELL_SHIFT = 8;
+/* Surfaces covering more cells than this are tested on every query rather
+ * than filling the grid, only huge or far off-screen trees get there */
+static constexpr int64_t MAX_CELLS = 1024;
+
+static constexpr uint64_t cell_key(int32_t const cx, int32_t const cy)
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32
+        | static_cast<uint32_t>(cy);
+}
+
+struct CellRange {
+    int32_t x1, y1, x2, y2;
+
+    explicit CellRange(wlr_box const& box)
+        : x1(box.x >> CELL_SHIFT)
+        , y1(box.y >> CELL_SHIFT)
+        , x2((box.x + box.width - 1) >> CELL_SHIFT)
+        , y2((box.y + box.height - 1) >> CELL_SHIFT)
+    {
+    }
+
+    [[nodiscard]] int64_t count() const
+    {
+        return static_cast<int64_t>(x2 - x1 + 1) * (y2 - y1 + 1);
+    }
+};
+
+/* Layout-space box of a buffer node, scaled like the scene draws it */
+static wlr_box buffer_box(wlr_scene_buffer const* buffer, int const x,
+                          int const y)
+{
+    int width = buffer->dst_width;
+    int height = buffer->dst_height;
+    if ((width <= 0 || height <= 0) && buffer->buffer != nullptr) {
+        bool const rotated = buffer->transform & WL_OUTPUT_TRANSFORM_90;
+        width = rotated ? buffer->buffer->height : buffer->buffer->width;
+        height = rotated ? buffer->buffer->width : buffer->buffer->height;
+    }
+
+    return { x, y, std::max(width, 0), std::max(height, 0) };
+}
+
+static bool box_contains(wlr_box const& box, double const x, double const y)
+{
+    return x >= box.x && x < box.x + box.width && y >= box.y
+        && y < box.y + box.height;
+}
+
+SurfaceIndex::SurfaceIndex(Server& server) noexcept
+    : server(server)
+{
+}
+
+void SurfaceIndex::add(Surface& surface)
+{
+    auto const [it, inserted] = entries.try_emplace(&surface);
+    if (inserted) {
+        dirty.push_back(&surface);
+    }
+    restacked = true;
+    current_generation++;
+}
+
+void SurfaceIndex::remove(Surface& surface)
+{
+    auto const it = entries.find(&surface);
+    if (it == entries.end()) {
+        return;
+    }
+
+    remove_cells(&surface, it->second);
+    if (it->second.dirty) {
+        std::erase(dirty, &surface);
+    }
+    entries.erase(it);
+    current_generation++;
+}
+
+void SurfaceIndex::mark_dirty(Surface& surface)
+{
+    /* The surface may come from the data field of a wlr_surface, which can
+     * outlive it, only look into it once we know it is still around */
+    if (!entries.contains(&surface) || surface.scene_tree == nullptr) {
+        return;
+    }
+    current_generation++;
+
+    /* Nested trees (popups, transient X11 windows) grow the bounds of the
+     * surfaces they are nested in */
+    for (wlr_scene_tree const* tree = surface.scene_tree; tree != nullptr;
+         tree = tree->node.parent) {
+        if (tree->node.data == nullptr) {
+            continue;
+        }
+
+        auto* const indexed = static_cast<Surface*>(tree->node.data);
+        auto const it = entries.find(indexed);
+        if (it != entries.end() && !it->second.dirty) {
+            it->second.dirty = true;
+            dirty.push_back(indexed);
+        }
+    }
+}
+
+void SurfaceIndex::mark_all_dirty()
+{
+    all_dirty = true;
+    current_generation++;
+}
+
+void SurfaceIndex::mark_restacked()
+{
+    restacked = true;
+    current_generation++;
+}
+
+/* For changes that neither move bounds nor restack, like a subsurface going
+ * away under the pointer */
+void SurfaceIndex::mark_changed() { current_generation++; }
+
+void SurfaceIndex::insert_cells(Surface* surface, Entry& entry)
+{
+    entry.oversized = false;
+    if (wlr_box_empty(&entry.bounds)) {
+        return;
+    }
+
+    CellRange const range(entry.bounds);
+    if (range.count() > MAX_CELLS) {
+        entry.oversized = true;
+        oversized.push_back(surface);
+        return;
+    }
+
+    for (int32_t cy = range.y1; cy <= range.y2; cy++) {
+        for (int32_t cx = range.x1; cx <= range.x2; cx++) {
+            cells[cell_key(cx, cy)].push_back(surface);
+        }
+    }
+}
+
+void SurfaceIndex::remove_cells(Surface* surface, Entry const& entry)
+{
+    if (entry.oversized) {
+        std::erase(oversized, surface);
+        return;
+    }
+    if (wlr_box_empty(&entry.bounds)) {
+        return;
+    }
+
+    CellRange const range(entry.bounds);
+    for (int32_t cy = range.y1; cy <= range.y2; cy++) {
+        for (int32_t cx = range.x1; cx <= range.x2; cx++) {
+            auto const cell = cells.find(cell_key(cx, cy));
+            if (cell == cells.end()) {
+                continue;
+            }
+            std::erase(cell->second, surface);
+            if (cell->second.empty()) {
+                cells.erase(cell);
+            }
+        }
+    }
+}
+
+/* Numbers the indexed surfaces in the order the scene draws them */
+void SurfaceIndex::restack(wlr_scene_tree const* tree)
+{
+    if (tree->node.data != nullptr) {
+        auto const it = entries.find(static_cast<Surface*>(tree->node.data));
+        if (it != entries.end()) {
+            it->second.z = next_z++;
+        }
+    }
+
+    wlr_scene_node* child = {};
+    wl_list_for_each(child, &tree->children, link)
+    {
+        if (child->type == WLR_SCENE_NODE_TREE) {
+            restack(wlr_scene_tree_from_node(child));
+        }
+    }
+}
+
+void SurfaceIndex::refresh()
+{
+    if (all_dirty) {
+        cells.clear();
+        oversized.clear();
+        dirty.clear();
+        for (auto& [surface, entry] : entries) {
+            entry.bounds = surface->get_bounds();
+            entry.dirty = false;
+            insert_cells(surface, entry);
+        }
+        all_dirty = false;
+    }
+
+    for (auto* surface : dirty) {
+        Entry& entry = entries.at(surface);
+        wlr_box const bounds = surface->get_bounds();
+        if (!wlr_box_equal(&bounds, &entry.bounds)) {
+            remove_cells(surface, entry);
+            entry.bounds = bounds;
+            insert_cells(surface, entry);
+        }
+        entry.dirty = false;
+    }
+    dirty.clear();
+
+    if (restacked) {
+        next_z = 0;
+        restack(&server.scene->tree);
+        restacked = false;
+    }
+}
+
+/* Returns the surface under the given layout coordinates, the same one a
+ * wlr_scene_node_at() on the whole scene would lead to. */
+Surface* SurfaceIndex::at(double const lx, double const ly, wlr_surface** wlr,
+                          double* sx, double* sy, wlr_box* exclusive)
+{
+    refresh();
+    if (exclusive != nullptr) {
+        *exclusive = {};
+    }
+
+    candidates.clear();
+    auto const cx = static_cast<int32_t>(std::floor(lx)) >> CELL_SHIFT;
+    auto const cy = static_cast<int32_t>(std::floor(ly)) >> CELL_SHIFT;
+    auto const cell = cells.find(cell_key(cx, cy));
+    if (cell != cells.end()) {
+        for (auto* surface : cell->second) {
+            if (box_contains(entries.at(surface).bounds, lx, ly)) {
+                candidates.push_back(surface);
+            }
+        }
+    }
+    for (auto* surface : oversized) {
+        if (box_contains(entries.at(surface).bounds, lx, ly)) {
+            candidates.push_back(surface);
+        }
+    }
+
+    std::ranges::sort(candidates, [this](Surface* a, Surface* b) {
+        return entries.at(a).z > entries.at(b).z;
+    });
+
+    for (auto* surface : candidates) {
+        int x, y;
+        /* Bounds go stale when a parent tree is disabled without the
+         * surface being marked, e.g. when hiding a whole workspace */
+        if (surface->scene_tree == nullptr
+            || !wlr_scene_node_coords(&surface->scene_tree->node, &x, &y)) {
+            continue;
+        }
+
+        wlr_scene_node* node
+            = wlr_scene_node_at(&surface->scene_tree->node, lx, ly, sx, sy);
+        if (node == nullptr) {
+            continue;
+        }
+
+        /* Topmost node at this point, we only care about surface nodes as we
+         * are specifically looking for a surface in the surface tree of a
+         * naoland surface. */
+        if (node->type != WLR_SCENE_NODE_BUFFER) {
+            return nullptr;
+        }
+        wlr_scene_buffer* scene_buffer = wlr_scene_buffer_from_node(node);
+        wlr_scene_surface const* scene_surface
+            = wlr_scene_surface_try_from_buffer(scene_buffer);
+        if (!scene_surface) {
+            return nullptr;
+        }
+
+        *wlr = scene_surface->surface;
+        if (exclusive != nullptr) {
+            *exclusive = exclusive_box(surface, scene_buffer, cx, cy);
+        }
+
+        /* Find the node corresponding to the naoland surface at the root of
+         * this surface tree, it is the only one for which we set the data
+         * field. */
+        wlr_scene_tree const* tree = node->parent;
+        while (tree != nullptr && tree->node.data == nullptr) {
+            tree = tree->node.parent;
+        }
+
+        return tree != nullptr ? static_cast<Surface*>(tree->node.data)
+                               : nullptr;
+    }
+
+    return nullptr;
+}
+
+struct ExclusiveBoxData {
+    wlr_scene_buffer const* buffer;
+    wlr_box box;
+    int offset_x, offset_y;
+    bool passed;
+    bool overlapped;
+};
+
+static void exclusive_box_iterator(wlr_scene_buffer* buffer, int const sx,
+                                   int const sy, void* user_data)
+{
+    auto& data = *static_cast<ExclusiveBoxData*>(user_data);
+
+    if (buffer == data.buffer) {
+        data.passed = true;
+        return;
+    }
+    if (!data.passed || data.overlapped) {
+        return;
+    }
+
+    /* Buffers are iterated bottom to top, this one is drawn above */
+    wlr_box const above
+        = buffer_box(buffer, sx + data.offset_x, sy + data.offset_y);
+    wlr_box intersection;
+    data.overlapped = wlr_box_intersection(&intersection, &above, &data.box);
+}
+
+/* Part of the grid cell (cx, cy) covered by `buffer` and nothing above it.
+ * Rather than carving out overlapping surfaces, any overlap gives up: this
+ * only has to hold for the common case of a pointer over a plain window. */
+wlr_box SurfaceIndex::exclusive_box(Surface* surface, wlr_scene_buffer* buffer,
+                                    int32_t const cx, int32_t const cy)
+{
+    int bx, by;
+    wlr_scene_node_coords(&buffer->node, &bx, &by);
+    wlr_box const hit = buffer_box(buffer, bx, by);
+    wlr_box const cell = { cx << CELL_SHIFT, cy << CELL_SHIFT, 1 << CELL_SHIFT,
+                           1 << CELL_SHIFT };
+    wlr_box box;
+    if (!wlr_box_intersection(&box, &hit, &cell)) {
+        return {};
+    }
+
+    /* Everything nested in the outermost indexed tree is covered by walking
+     * its buffers below, other surfaces by their bounds */
+    Surface* root = surface;
+    for (wlr_scene_tree const* tree = surface->scene_tree; tree != nullptr;
+         tree = tree->node.parent) {
+        auto* const indexed = static_cast<Surface*>(tree->node.data);
+        if (indexed != nullptr && entries.contains(indexed)) {
+            root = indexed;
+        }
+    }
+
+    uint32_t const root_z = entries.at(root).z;
+    auto const overlaps = [&](Surface* other) {
+        Entry const& entry = entries.at(other);
+        wlr_box intersection;
+        return other != root && entry.z > root_z
+            && wlr_box_intersection(&intersection, &entry.bounds, &box);
+    };
+    auto const cell_surfaces = cells.find(cell_key(cx, cy));
+    if (cell_surfaces != cells.end()
+        && std::ranges::any_of(cell_surfaces->second, overlaps)) {
+        return {};
+    }
+    if (std::ranges::any_of(oversized, overlaps)) {
+        return {};
+    }
+
+    int lx, ly;
+    wlr_scene_node_coords(&root->scene_tree->node, &lx, &ly);
+    ExclusiveBoxData data = {
+        .buffer = buffer,
+        .box = box,
+        /* The iterator reports positions relative to the parent of the tree */
+        .offset_x = lx - root->scene_tree->node.x,
+        .offset_y = ly - root->scene_tree->node.y,
+        .passed = false,
+        .overlapped = false,
+    };
+    wlr_scene_node_for_each_buffer(&root->scene_tree->node,
+                                   exclusive_box_iterator, &data);
+    if (data.overlapped) {
+        return {};
+    }
+
+    return box;
+}
@@ -0,0 +1,81 @@
+#ifndef NAOLAND_SURFACE_INDEX_HPP
+#define NAOLAND_SURFACE_INDEX_HPP
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "wlr-wrap-start.hpp"
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
+#include "wlr-wrap-end.hpp"
+
+/*
+ * Uniform grid over the bounds of every surface with a scene tree, used to
+ * find the surfaces under a point without walking the whole scene graph.
+ *
+ * Entries are only recomputed when marked dirty: surfaces are marked when they
+ * commit, are damaged or moved, and the stacking order when a tree is raised
+ * or reparented. The grid only narrows down the candidates; the surface under
+ * the point is still found by wlr_scene_node_at() on the candidate trees, top
+ * to bottom, so stale bounds can cost a test but not give a wrong answer as
+ * long as they never grow without the surface being marked.
+ */
+class SurfaceIndex {
+public:
+    explicit SurfaceIndex(Server& server) noexcept;
+
+    void add(Surface& surface);
+    void remove(Surface& surface);
+    /* Marks `surface` and every indexed surface its scene tree is nested in,
+     * does nothing if `surface` itself is not indexed */
+    void mark_dirty(Surface& surface);
+    void mark_all_dirty();
+    void mark_restacked();
+    void mark_changed();
+
+    /* Moves whenever a surface is added, removed, marked or restacked, so
+     * anything derived from where surfaces are can tell when to recompute
+     * it. Unlike Server::scene_generation, new buffer contents and animation
+     * snapshots leave it alone. */
+    [[nodiscard]] uint64_t generation() const { return current_generation; }
+
+    /* When `exclusive` is given, it receives a box around the point in which
+     * nothing but the surface found can be hit, or an empty box if something
+     * else may overlap it. It stays valid until the scene changes. */
+    Surface* at(double lx, double ly, wlr_surface** wlr, double* sx,
+                double* sy, wlr_box* exclusive = nullptr);
+
+private:
+    struct Entry {
+        wlr_box bounds = {};
+        /* Position in the scene, higher is drawn above */
+        uint32_t z = 0;
+        bool dirty = true;
+        /* Covers too many cells, kept in `oversized` instead of the grid */
+        bool oversized = false;
+    };
+
+    Server& server;
+    std::unordered_map<Surface const*, Entry> entries;
+    std::unordered_map<uint64_t, std::vector<Surface*>> cells;
+    std::vector<Surface*> oversized;
+    std::vector<Surface*> dirty;
+    bool all_dirty = false;
+    bool restacked = false;
+    uint64_t current_generation = 1;
+    uint32_t next_z = 0;
+    /* Reused by every query */
+    std::vector<Surface*> candidates;
+
+    void insert_cells(Surface* surface, Entry& entry);
+    void remove_cells(Surface* surface, Entry const& entry);
+    void refresh();
+    void restack(wlr_scene_tree const* tree);
+    wlr_box exclusive_box(Surface* surface, wlr_scene_buffer* buffer,
+                          int32_t cx, int32_t cy);
+};
+
+#endif
@@ -23,11 +23,149 @@
 #include "wlr-wrap-end.hpp"
 
 View::View() noexcept
-    : animation(*this)
+    : Surface(NAOLAND_SURFACE_TYPE_VIEW)
+    , animation(*this)
     , listeners(*this)
 {
 }
 
+View::~View() noexcept
+{
+    unlink_workspace();
+    if (resize_timer != nullptr) {
+        wl_event_source_remove(resize_timer);
+    }
+}
+
+/* Puts the view at the front of `workspace`'s views */
+void View::link_workspace(Workspace& workspace)
+{
+    this->workspace = &workspace;
+    mru_prev = nullptr;
+    mru_next = workspace.views;
+    if (mru_next != nullptr) {
+        mru_next->mru_prev = this;
+    }
+    workspace.views = this;
+}
+
+void View::unlink_workspace()
+{
+    if (workspace == nullptr) {
+        return;
+    }
+
+    if (mru_prev != nullptr) {
+        mru_prev->mru_next = mru_next;
+    } else {
+        workspace->views = mru_next;
+    }
+    if (mru_next != nullptr) {
+        mru_next->mru_prev = mru_prev;
+    }
+    workspace = nullptr;
+    mru_prev = nullptr;
+    mru_next = nullptr;
+}
+
+/* Marks the view as the most recently used one of its workspace */
+void View::raise_in_workspace()
+{
+    if (workspace == nullptr || workspace->views == this) {
+        return;
+    }
+
+    Workspace& current = *workspace;
+    unlink_workspace();
+    link_workspace(current);
+}
+
+/* Whether the view's tree sits directly in a workspace, rather than nested
+ * in the tree of another view */
+static bool is_top_level(View const& view)
+{
+    if (view.scene_tree == nullptr) {
+        return false;
+    }
+
+    wlr_scene_tree const* parent = view.scene_tree->node.parent;
+    return parent == view.get_server().scene_layers[NAOLAND_SCENE_LAYER_NORMAL]
+        || (view.workspace != nullptr
+            && parent == view.workspace->scene_tree);
+}
+
+/* Gives up a workspace left by a view, if it was the last thing keeping it */
+static void release_workspace(Workspace* workspace)
+{
+    if (workspace != nullptr && workspace->output != nullptr) {
+        workspace->output->release_workspace(*workspace);
+    }
+}
+
+/* Moves the view to the front of `workspace`, and its tree into the
+ * workspace's one */
+void View::enter_workspace(Workspace& workspace)
+{
+    Workspace* previous = this->workspace;
+    if (is_top_level(*this)) {
+        wlr_scene_node_reparent(&scene_tree->node, workspace.scene_tree);
+    }
+    unlink_workspace();
+    link_workspace(workspace);
+    if (previous != &workspace) {
+        release_workspace(previous);
+    }
+}
+
+/* Moves the view to the active workspace of the output its centre is on, so a
+ * view dragged or resized over to another output keeps being shown there */
+void View::follow_output()
+{
+    if (workspace == nullptr || !is_top_level(*this)) {
+        return;
+    }
+
+    Server& server = get_server();
+    wlr_output* wlr = wlr_output_layout_output_at(
+        server.output_layout, current.x + current.width / 2.0,
+        current.y + current.height / 2.0);
+    if (wlr == nullptr || wlr->data == nullptr) {
+        return;
+    }
+
+    Workspace* target = static_cast<Output*>(wlr->data)->active_workspace;
+    if (target == nullptr || target == workspace) {
+        return;
+    }
+
+    if (server.task_switch_view == this) {
+        server.task_switch_view = nullptr;
+    }
+    enter_workspace(*target);
+    server.scene_generation++;
+    server.surface_index.mark_restacked();
+    server.surface_index.mark_dirty(*this);
+    damage();
+}
+
+/* Called when the view is unmapped */
+void View::leave_workspace()
+{
+    Server& server = get_server();
+    if (server.task_switch_view == this) {
+        server.task_switch_view = nullptr;
+    }
+
+    Workspace* previous = workspace;
+    if (is_top_level(*this)) {
+        wlr_scene_node_reparent(
+            &scene_tree->node,
+            server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL]);
+    }
+    unlink_workspace();
+    release_workspace(previous);
+}
+
 std::optional<std::reference_wrapper<Output>>
 View::find_output_for_maximize() const
 {
@@ -91,6 +229,7 @@ static void close_on_animation_finish(void* data)
 {
     View* view = static_cast<View*>(data);
     wlr_scene_node_set_enabled(&view->scene_tree->node, false);
+    view->damage();
     view->close();
 }
 
@@ -106,6 +245,8 @@ void View::close_animation()
 
 void View::map()
 {
+    enter_workspace(get_server().active_workspace());
+
     animation.start(AnimationOptions {
             .kind = ANIMATION_FADE_IN,
             .role = get_server().config.animation.window_animation.open,
@@ -164,12 +305,111 @@ void View::set_geometry(int32_t const x, int32_t const y, int32_t const width,
         previous = current;
     }
     current = { x, std::max(y, 0), bounded_width, bounded_height };
+    resize_waiting = false;
+    resize_queued = false;
+    if (resize_timer != nullptr) {
+        wl_event_source_timer_update(resize_timer, 0);
+    }
     if (scene_tree != nullptr) {
         wlr_scene_node_set_position(&scene_tree->node, current.x, current.y);
+        damage();
     }
     impl_set_geometry(current.x, current.y, current.width, current.height);
 }
 
+/* How long a configure may go unanswered before the next one is sent anyway,
+ * so a stuck client does not stop the resize altogether */
+static constexpr int RESIZE_ACK_TIMEOUT_MSEC = 200;
+
+static int view_resize_timer_notify(void* data)
+{
+    static_cast<View*>(data)->flush_resize();
+    return 0;
+}
+
+/* Resizes the view for an interactive resize. Slow clients would fall behind
+ * a configure per pointer motion, so while one is in flight only the latest
+ * geometry is kept. The position is applied along with the buffer at the new
+ * size, see resize_committed(). */
+void View::resize_interactive(int32_t const x, int32_t const y,
+                              int32_t const width, int32_t const height)
+{
+    wlr_box const min_size = get_min_size();
+    wlr_box const max_size = get_max_size();
+    wlr_box const box = { x, std::max(y, 0),
+                          std::clamp(width, min_size.width, max_size.width),
+                          std::clamp(height, min_size.height,
+                                     max_size.height) };
+
+    if (resize_waiting
+        && get_monotonic_time_nsec() - resize_sent_nsec
+            < RESIZE_ACK_TIMEOUT_MSEC * 1000000LL) {
+        resize_next = box;
+        resize_queued = true;
+        return;
+    }
+
+    send_resize(box);
+}
+
+void View::send_resize(wlr_box const& box)
+{
+    if (curr_placement == VIEW_PLACEMENT_STACKING) {
+        previous = current;
+    }
+    current = box;
+    resize_sent = box;
+    resize_queued = false;
+    resize_waiting = true;
+    resize_sent_nsec = get_monotonic_time_nsec();
+    resize_serial
+        = impl_set_geometry(box.x, box.y, box.width, box.height);
+
+    if (resize_timer == nullptr) {
+        resize_timer = wl_event_loop_add_timer(
+            wl_display_get_event_loop(get_server().display),
+            view_resize_timer_notify, this);
+    }
+    if (resize_timer != nullptr) {
+        wl_event_source_timer_update(resize_timer, RESIZE_ACK_TIMEOUT_MSEC);
+    }
+}
+
+/* Sends the size waiting behind an unanswered configure, when the client
+ * took too long to answer or the interactive resize ended */
+void View::flush_resize()
+{
+    if (resize_queued) {
+        send_resize(resize_next);
+    }
+}
+
+/* Called on every commit with the serial of the last configure the client
+ * acked. Once it caught up with the resize, the view is moved to match the
+ * new buffer and the next queued size goes out. */
+void View::resize_committed(uint32_t const serial)
+{
+    if (!resize_waiting
+        || static_cast<int32_t>(serial - resize_serial) < 0) {
+        return;
+    }
+
+    resize_waiting = false;
+    if (resize_timer != nullptr) {
+        wl_event_source_timer_update(resize_timer, 0);
+    }
+    if (scene_tree != nullptr) {
+        wlr_scene_node_set_position(&scene_tree->node, resize_sent.x,
+                                    resize_sent.y);
+    }
+    update_outputs();
+    follow_output();
+
+    if (resize_queued) {
+        send_resize(resize_next);
+    }
+}
+
 void View::set_position(int32_t const x, int32_t const y)
 {
     if (curr_placement == VIEW_PLACEMENT_STACKING) {
@@ -180,6 +420,7 @@ void View::set_position(int32_t const x, int32_t const y)
     current.y = std::max(y, 0);
     if (scene_tree != nullptr) {
         wlr_scene_node_set_position(&scene_tree->node, current.x, current.y);
+        damage();
     }
     impl_set_position(current.x, current.y);
 }
@@ -235,7 +476,11 @@ void View::set_activated(bool const activated)
         toplevel_handle->set_activated(activated);
     }
 
-    is_active = activated;
+    if (is_active != activated) {
+        /* The border color changes with the focus */
+        is_active = activated;
+        damage();
+    }
 }
 
 void View::set_placement(ViewPlacement const new_placement, bool const force)
@@ -360,11 +605,12 @@ void View::set_minimized(bool const minimized)
     this->is_minimized = minimized;
 
     if (minimized) {
-        wlr_scene_node_set_enabled(&scene_tree->node, false);
         set_activated(false);
+        wlr_scene_node_set_enabled(&scene_tree->node, false);
     } else {
         wlr_scene_node_set_enabled(&scene_tree->node, true);
     }
+    damage();
 }
 
 void View::toggle_maximize()
@@ -419,10 +665,21 @@ void View::destroy_decorations()
 
 void View::move_to_workspace(int number)
 {
-    if (number > WORKSPACE_COUNT) return;
-    if (number < 1) return;
-    number -= 1;
+    if (number < 1 || workspace == nullptr || workspace->output == nullptr) {
+        return;
+    }
+
+    Workspace& target = workspace->output->get_workspace(number);
+    if (&target == workspace) {
+        return;
+    }
 
-    Workspace workspace = get_server().workspaces[number];
-    wlr_scene_node_reparent(&scene_tree->node, workspace.scene_tree);
+    Server& server = get_server();
+    if (server.task_switch_view == this) {
+        server.task_switch_view = nullptr;
+    }
+    enter_workspace(target);
+    get_server().scene_generation++;
+    get_server().surface_index.mark_restacked();
+    damage();
 }
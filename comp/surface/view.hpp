@@ -43,8 +43,25 @@ struct View : Surface {
     wlr_xdg_toplevel_decoration_v1* xdg_toplevel_decoration;
     Animation animation;
 
+    /* The workspace this view is mapped on, and its neighbours in the most
+     * recently used order of that workspace, see Workspace::views */
+    Workspace* workspace = nullptr;
+    View* mru_prev = nullptr;
+    View* mru_next = nullptr;
+
+    /* Interactive resize keeps a single configure in flight, newer sizes wait
+     * in `resize_next` until the client commits the one sent or
+     * `resize_timer` gives up on it */
+    bool resize_waiting = false;
+    bool resize_queued = false;
+    uint32_t resize_serial = 0;
+    int64_t resize_sent_nsec = 0;
+    wlr_box resize_sent = {};
+    wlr_box resize_next = {};
+    wl_event_source* resize_timer = nullptr;
+
     View() noexcept;
-    ~View() noexcept override = default;
+    ~View() noexcept override;
 
     [[nodiscard]] virtual bool is_x11() const = 0;
     [[nodiscard]] virtual wlr_box get_geometry() const = 0;
@@ -62,6 +79,10 @@ struct View : Surface {
     void set_position(int32_t x, int32_t y);
     void set_size(int32_t width, int32_t height);
     void set_geometry(int32_t x, int32_t y, int32_t width, int32_t height);
+    void resize_interactive(int32_t x, int32_t y, int32_t width,
+                            int32_t height);
+    void resize_committed(uint32_t serial);
+    void flush_resize();
     void update_outputs(bool ignore_previous = false) const;
     void set_activated(bool activated);
     void set_placement(ViewPlacement new_placement, bool force = false);
@@ -71,6 +92,10 @@ struct View : Surface {
     void setup_decorations(wlr_xdg_toplevel_decoration_v1* decoration);
     void destroy_decorations();
     void move_to_workspace(int number);
+    void raise_in_workspace();
+    void enter_workspace(Workspace& workspace);
+    void leave_workspace();
+    void follow_output();
 
 private:
     Listeners listeners = Listeners(*this);
@@ -80,13 +105,18 @@ private:
     void stack();
     bool maximize();
     bool fullscreen();
+    void send_resize(wlr_box const& box);
+    void link_workspace(Workspace& workspace);
+    void unlink_workspace();
 
 protected:
     virtual void impl_map() = 0;
 
     virtual void impl_set_position(int32_t x, int32_t y) = 0;
     virtual void impl_set_size(int32_t width, int32_t height) = 0;
-    virtual void impl_set_geometry(int x, int y, int width, int height) = 0;
+    /* Returns the serial of the configure sent, 0 if there is none */
+    virtual uint32_t impl_set_geometry(int x, int y, int width, int height)
+        = 0;
     virtual void impl_set_activated(bool activated) = 0;
     virtual void impl_set_fullscreen(bool fullscreen) = 0;
     virtual void impl_set_maximized(bool maximized) = 0;
@@ -145,7 +175,7 @@ protected:
 
     void impl_set_position(int32_t x, int32_t y) override;
     void impl_set_size(int32_t width, int32_t height) override;
-    void impl_set_geometry(int x, int y, int width, int height) override;
+    uint32_t impl_set_geometry(int x, int y, int width, int height) override;
     void impl_set_activated(bool activated) override;
     void impl_set_fullscreen(bool fullscreen) override;
     void impl_set_maximized(bool maximized) override;
@@ -202,8 +232,8 @@ protected:
 
     void impl_set_position(int32_t x, int32_t y) override;
     void impl_set_size(int32_t width, int32_t height) override;
-    void impl_set_geometry(int32_t x, int32_t y, int width,
-                           int height) override;
+    uint32_t impl_set_geometry(int32_t x, int32_t y, int width,
+                               int height) override;
     void impl_set_activated(bool activated) override;
     void impl_set_fullscreen(bool fullscreen) override;
     void impl_set_maximized(bool maximized) override;
@@ -29,12 +29,23 @@ static void xdg_toplevel_unmap_notify(wl_listener* listener, void*)
     view.unmap();
 }
 
+/* Called when a new surface state is committed. The window geometry may have
+ * changed with it, which moves the borders drawn around the view. */
+static void xdg_toplevel_commit_notify(wl_listener* listener, void*)
+{
+    XdgView& view = naoland_container_of(listener, view, commit);
+
+    if (view.xdg_toplevel.base->surface->mapped) {
+        view.resize_committed(view.xdg_toplevel.base->current.configure_serial);
+        view.damage();
+    }
+}
+
 /* Called when the surface is destroyed and should never be shown again. */
 static void xdg_toplevel_destroy_notify(wl_listener* listener, void*)
 {
     XdgView& view = naoland_container_of(listener, view, destroy);
 
-    view.server.views.remove(&view);
     delete &view;
 }
 
@@ -143,6 +154,7 @@ XdgView::XdgView(Server& server, wlr_xdg_toplevel& wlr) noexcept
      * to draw window borders.
      */
     wlr.base->surface->data = this;
+    server.surface_index.add(*this);
 
     toplevel_handle.emplace(*this);
     toplevel_handle->set_title(xdg_toplevel.title);
@@ -162,6 +174,8 @@ XdgView::XdgView(Server& server, wlr_xdg_toplevel& wlr) noexcept
     wl_signal_add(&wlr.base->surface->events.unmap, &listeners.unmap);
     listeners.destroy.notify = xdg_toplevel_destroy_notify;
     wl_signal_add(&wlr.base->events.destroy, &listeners.destroy);
+    listeners.commit.notify = xdg_toplevel_commit_notify;
+    wl_signal_add(&wlr.base->surface->events.commit, &listeners.commit);
     listeners.request_move.notify = xdg_toplevel_request_move_notify;
     wl_signal_add(&xdg_toplevel.events.request_move, &listeners.request_move);
     listeners.request_resize.notify = xdg_toplevel_request_resize_notify;
@@ -183,15 +197,15 @@ XdgView::XdgView(Server& server, wlr_xdg_toplevel& wlr) noexcept
     wl_signal_add(&xdg_toplevel.events.set_app_id, &listeners.set_app_id);
     listeners.set_parent.notify = xdg_toplevel_set_parent_notify;
     wl_signal_add(&xdg_toplevel.events.set_parent, &listeners.set_parent);
-
-    server.views.push_back(this);
 }
 
 XdgView::~XdgView() noexcept
 {
+    server.surface_index.remove(*this);
     wl_list_remove(&listeners.map.link);
     wl_list_remove(&listeners.unmap.link);
     wl_list_remove(&listeners.destroy.link);
+    wl_list_remove(&listeners.commit.link);
     wl_list_remove(&listeners.request_move.link);
     wl_list_remove(&listeners.request_resize.link);
     wl_list_remove(&listeners.request_maximize.link);
@@ -240,6 +254,7 @@ constexpr wlr_box XdgView::get_max_size() const
 void XdgView::unmap()
 {
     wlr_scene_node_set_enabled(&scene_tree->node, false);
+    damage();
 
     /* Reset the cursor mode if the grabbed view was unmapped. */
     if (this == server.grabbed_view) {
@@ -249,6 +264,8 @@ void XdgView::unmap()
     if (this == server.focused_view) {
         server.focused_view = nullptr;
     }
+
+    leave_workspace();
 }
 
 void XdgView::close() { wlr_xdg_toplevel_send_close(&xdg_toplevel); }
@@ -296,12 +313,12 @@ void XdgView::impl_set_size(int32_t const width, int32_t const height)
     wlr_xdg_toplevel_set_size(&xdg_toplevel, width, height);
 }
 
-void XdgView::impl_set_geometry(int const x, int const y, int const width,
-                                int const height)
+uint32_t XdgView::impl_set_geometry(int const x, int const y,
+                                    int const width, int const height)
 {
     (void)x;
     (void)y;
-    wlr_xdg_toplevel_set_size(&xdg_toplevel, width, height);
+    return wlr_xdg_toplevel_set_size(&xdg_toplevel, width, height);
 }
 
 void XdgView::impl_set_activated(bool const activated)
@@ -30,6 +30,18 @@ static void xwayland_surface_unmap_notify(wl_listener* listener, void*)
     view.unmap();
 }
 
+/* Called when a new surface state is committed, the buffer size decides where
+ * the borders are drawn. */
+static void xwayland_surface_commit_notify(wl_listener* listener, void*)
+{
+    XWaylandView& view = naoland_container_of(listener, view, commit);
+
+    if (view.scene_tree != nullptr) {
+        view.resize_committed(view.resize_serial);
+        view.damage();
+    }
+}
+
 static void xwayland_surface_associate_notify(wl_listener* listener, void*)
 {
     XWaylandView& view = naoland_container_of(listener, view, associate);
@@ -40,6 +52,9 @@ static void xwayland_surface_associate_notify(wl_listener* listener, void*)
     view.listeners.unmap.notify = xwayland_surface_unmap_notify;
     wl_signal_add(&view.xwayland_surface.surface->events.unmap,
                   &view.listeners.unmap);
+    view.listeners.commit.notify = xwayland_surface_commit_notify;
+    wl_signal_add(&view.xwayland_surface.surface->events.commit,
+                  &view.listeners.commit);
 }
 
 static void xwayland_surface_dissociate_notify(wl_listener* listener, void*)
@@ -48,6 +63,7 @@ static void xwayland_surface_dissociate_notify(wl_listener* listener, void*)
 
     wl_list_remove(&view.listeners.map.link);
     wl_list_remove(&view.listeners.unmap.link);
+    wl_list_remove(&view.listeners.commit.link);
 }
 
 /* Called when the surface is destroyed and should never be shown again. */
@@ -55,7 +71,6 @@ static void xwayland_surface_destroy_notify(wl_listener* listener, void*)
 {
     XWaylandView& view = naoland_container_of(listener, view, destroy);
 
-    view.server.views.remove(&view);
     delete &view;
 }
 
@@ -155,6 +170,9 @@ static void xwayland_surface_set_parent_notify(wl_listener* listener, void*)
         if (m_view != nullptr && view.scene_tree != nullptr) {
             wlr_scene_node_reparent(&view.scene_tree->node,
                                     m_view->scene_tree);
+            view.server.scene_generation++;
+            view.server.surface_index.mark_restacked();
+            view.damage();
             if (view.toplevel_handle.has_value()
                 && m_view->toplevel_handle.has_value()) {
                 view.toplevel_handle->set_parent(
@@ -209,6 +227,7 @@ XWaylandView::XWaylandView(Server& server,
 
 XWaylandView::~XWaylandView() noexcept
 {
+    server.surface_index.remove(*this);
     wl_list_remove(&listeners.associate.link);
     wl_list_remove(&listeners.destroy.link);
     wl_list_remove(&listeners.request_configure.link);
@@ -263,6 +282,8 @@ constexpr wlr_box XWaylandView::get_max_size() const
 void XWaylandView::unmap()
 {
     wlr_scene_node_set_enabled(&scene_tree->node, false);
+    damage();
+    server.surface_index.remove(*this);
     wlr_scene_node_destroy(&scene_tree->node);
     scene_tree = nullptr;
     Cursor& cursor = server.seat->cursor;
@@ -281,7 +302,7 @@ void XWaylandView::unmap()
         server.seat->wlr->keyboard_state.focused_surface = nullptr;
     }
 
-    server.views.remove(this);
+    leave_workspace();
 
     toplevel_handle.reset();
 }
@@ -315,7 +336,9 @@ void XWaylandView::impl_map()
     toplevel_handle->set_app_id(xwayland_surface._class);
 
     scene_tree = wlr_scene_subsurface_tree_create(
-        server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL], xwayland_surface.surface);
+        workspace != nullptr ? workspace->scene_tree
+                             : server.scene_layers[NAOLAND_SCENE_LAYER_NORMAL],
+        xwayland_surface.surface);
     scene_tree->node.data = this;
 
     if (xwayland_surface.parent != nullptr) {
@@ -329,6 +352,7 @@ void XWaylandView::impl_map()
 
     wlr_scene_node_set_enabled(&scene_tree->node, true);
     wlr_scene_node_set_position(&scene_tree->node, current.x, current.y);
+    server.surface_index.add(*this);
 
     if (xwayland_surface.fullscreen) {
         set_placement(VIEW_PLACEMENT_FULLSCREEN);
@@ -337,7 +361,6 @@ void XWaylandView::impl_map()
         set_placement(VIEW_PLACEMENT_MAXIMIZED);
     }
 
-    server.views.insert(server.views.begin(), this);
     update_outputs(true);
     server.focus_view(this);
 }
@@ -354,11 +377,14 @@ void XWaylandView::impl_set_size(int32_t const width, int32_t const height)
                                    trunc(current.y), width, height);
 }
 
-void XWaylandView::impl_set_geometry(int32_t const x, int32_t const y,
-                                     int32_t const width, int32_t const height)
+uint32_t XWaylandView::impl_set_geometry(int32_t const x, int32_t const y,
+                                         int32_t const width,
+                                         int32_t const height)
 {
     wlr_xwayland_surface_configure(&xwayland_surface, trunc(x), trunc(y),
                                    trunc(width), trunc(height));
+    /* X11 has no configure serials, the next commit is taken as the answer */
+    return 0;
 }
 
 void XWaylandView::impl_set_activated(bool const activated)
@@ -22,8 +22,14 @@ class Layer;
 class LayerSubsurface;
 class Popup;
 
+struct Workspace;
+
 class ForeignToplevelHandle;
 
+namespace Renderer {
+class TileCompositor;
+}
+
 enum ViewPlacement {
     VIEW_PLACEMENT_STACKING,
     VIEW_PLACEMENT_MAXIMIZED,
@@ -3,14 +3,15 @@
 #include <ctime>
 #include <cstdint>
 
-int64_t timespec_to_msec(const struct timespec *a)
+int64_t timespec_to_nsec(const struct timespec *a)
 {
-    return (int64_t)a->tv_sec * 1000 + a->tv_nsec / 1000000;
+    return (int64_t)a->tv_sec * 1000000000 + a->tv_nsec;
 }
 
-int64_t get_time_milli()
+/* The clock presentation timestamps and frame callbacks are based on */
+int64_t get_monotonic_time_nsec()
 {
     timespec now;
-    timespec_get(&now, TIME_UTC);
-    return timespec_to_msec(&now);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_nsec(&now);
 }
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 
-int64_t get_time_milli();
+int64_t timespec_to_nsec(const struct timespec *a);
+int64_t get_monotonic_time_nsec();
 
 #endif